@@ -2,8 +2,17 @@
 #define RAYTRACE_API_HH
 ///\file
 #include "ray.hh"
+#include "population_control.hh"
+#include "ray_buffer_pool.hh"
+#include "ray_fields.hh"
 #include <openPMD/openPMD.hpp> // openPMD C++ API
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <exception>
 
@@ -17,9 +26,50 @@ namespace raytracing {
  * This is meant to be used to save/read a coherent set of rays to/from file. \n
  * Coherent in this case means that a single type of rays (particles) are going to used.
  */
+class columnar_file;
+class shm_cache;
+class ray_session;
+
+/** \enum sampling_t
+ * \brief selection of the rays returned by the reading methods, see openPMD_io::set_sampling()
+ */
+enum sampling_t : int {
+	kSequential = 0, ///< the first n_rays rays of the file
+	kUniform,        ///< n_rays distinct rays drawn uniformly
+	kStratified,     ///< one ray drawn uniformly in each of n_rays blocks of equal size
+	kWeighted        ///< n_rays rays drawn with replacement proportionally to their weight
+};
+
+/** \enum sort_key_t
+ * \brief order of the rays within each chunk written, see openPMD_io::set_sort()
+ */
+enum sort_key_t : int {
+	kSortNone = 0,   ///< arrival order
+	kSortMorton,     ///< Morton (Z-order) code of the (x, y) position
+	kSortWavelength, ///< increasing wavelength
+	kSortTime        ///< increasing ray time
+};
+
+/** \struct backend_config
+ * \brief tuning options of the openPMD backends, see openPMD_io::set_backend_config()
+ *
+ * The options are translated into the JSON configuration of openPMD. The JSON strings, when
+ * given, are passed as they are and replace the corresponding options.
+ */
+struct backend_config {
+	std::string adios2_engine;          ///< ADIOS2 engine type ("bp4", "sst", ...)
+	unsigned int adios2_aggregators = 0; ///< ADIOS2 NumAggregators, 0 for the default
+	std::string adios2_buffer_size;     ///< ADIOS2 InitialBufferSize, e.g. "1Gb"
+	/// number of rays per HDF5 chunk, 0 for the default of openPMD
+	unsigned long long int hdf5_chunk = 0;
+	std::string series_json;  ///< JSON options of the openPMD::Series
+	std::string dataset_json; ///< JSON options of the datasets of the rays
+};
+
 class openPMD_io {
-	// Auxiliary classes that are private, so not part of the public API
-private:
+	// Auxiliary classes, public so that whole chunks of rays can be exchanged with
+	// read_chunk() and write_chunk()
+public:
 	/** \class Rays
 	 * \brief stores the rays' properties
 	 *
@@ -49,18 +99,47 @@ private:
 		/**\class Record
 		 * \brief template utility class to simplify implementation
 		 * It is a vector that also stores min and max values while filling
+		 *
+		 * The values can also be a view on memory owned by someone else (e.g. a memory
+		 * mapped file), in which case vals() is empty and data() points to the view.
 		 */
 		template <typename T> class Record {
-			std::vector<T> _vals;
+		public:
+			typedef T value_type;
+			/// values owned, in buffers recycled by the buffer_pool
+			typedef std::vector<T, pool_allocator<T>> vector_type;
+
+		private:
+			vector_type _vals;
 			T _min, _max;
+			const T* _view     = nullptr;
+			size_t _view_size = 0;
 
 		public:
 			Record(): _vals(), _min(), _max() { clear(); }
-			const std::vector<T>& vals(void) const { return _vals; };
-			std::vector<T>& vals(void) { return _vals; };
+			const vector_type& vals(void) const { return _vals; };
+			vector_type& vals(void) { return _vals; };
 			T min(void) const { return _min; };
 			T max(void) const { return _max; };
 
+			/// \brief pointer to the values, either owned or viewed
+			const T* data(void) const { return _view != nullptr ? _view : _vals.data(); }
+			/// \brief number of values, either owned or viewed
+			size_t size(void) const {
+				return _view != nullptr ? _view_size : _vals.size();
+			}
+
+			/** \brief use n values owned by someone else without copying them
+			 * The memory should stay valid until the next clear()
+			 */
+			void view(const T* vec, size_t n, T min, T max) {
+				_vals.clear();
+				_view      = vec;
+				_view_size = n;
+				_min       = min;
+				_max       = max;
+			}
+
 			// used when filling before writing
 			void push_back(T val) {
 				_vals.push_back(val);
@@ -76,15 +155,32 @@ private:
 				_max = max;
 			}
 
-			void clear_chunk(void) { _vals.clear(); }
+			/// \brief extends the min-max values to include the given range
+			void update_range(T min, T max) {
+				if (_min > min) _min = min;
+				if (_max < max) _max = max;
+			}
+
+			/// \brief sets the min-max values, when the values have been modified in place
+			void set_range(T min, T max) {
+				_min = min;
+				_max = max;
+			}
+
+			void clear_chunk(void) {
+				_vals.clear();
+				_view = nullptr;
+			}
 
 			void clear(void) {
 				std::numeric_limits<T> lim;
-				_max = lim.min();
+				_max = lim.lowest(); // min() is the smallest positive value for floats
 				_min = lim.max();
-				_vals.clear();
+				clear_chunk();
 			}
-			const T operator[](size_t i) const { return _vals[i]; }; // cannot modify
+			const T operator[](size_t i) const {
+				return _view != nullptr ? _view[i] : _vals[i];
+			}; // cannot modify
 		}; // end of Record class
 
 		//------------------------------ public memebers
@@ -200,21 +296,95 @@ private:
 		/** \brief returns the number of stored rays */
 		size_t size() const { return _size; };
 
-		/** \brief sets the size, it should match the content of the records! */
+		/** \brief sets the size, it should match the content of the records!
+		 * The records not loaded (see openPMD_io::set_projection()) are empty.
+		 */
 		void size(size_t s) {
 			_size = s;
-			if (_x.vals().size() != s)
-				throw std::runtime_error(
-				        "size of stored Rays and one of its records is different");
+			for_each([s](field_t, const auto& rec) {
+				if (rec.size() != s && rec.size() != 0)
+					throw std::runtime_error(
+					        "size of stored Rays and one of its records is different");
+			});
 		};
 
+		/** \brief reserves the memory of n rays in all the records
+		 * Pre-sizing the records from the chunk size avoids the reallocations while filling
+		 * the first chunk.
+		 */
+		void reserve(size_t n) {
+			for_each([n](field_t, auto& rec) { rec.vals().reserve(n); });
+		}
+
+		/** \brief copy the rays of another container, owning the values
+		 *
+		 * The min-max values are computed from the copied values. Unlike the copy
+		 * constructor, the values are copied also when other is a view on memory owned by
+		 * someone else.
+		 */
+		void copy(const Rays& other) {
+			clear();
+			for_each(other, [](field_t, auto& rec, const auto& src) {
+				rec.vals().reserve(src.size());
+				for (size_t i = 0; i < src.size(); ++i)
+					rec.push_back(src[i]);
+			});
+			size(other.size());
+		}
+
 		/** \brief check if all the data have been already retrieved
 		 * \return bool : true if all the data stored have been retrieved
 		 * it return true also if it is empty
 		 */
-		bool is_chunk_finished(void) { return _read == _size; }
+		bool is_chunk_finished(void) const { return _read == _size; }
+
+		/// \brief mark all the rays as retrieved, when they are accessed by records
+		void mark_read(void) { _read = _size; }
+
+		/** \brief calls f(field, record) for each of the records
+		 *
+		 * f should be a generic callable, since the records have different types
+		 */
+		template <typename F> void for_each(F&& f) { visit(f, *this); }
+		/// \brief calls f(field, record) for each of the records
+		template <typename F> void for_each(F&& f) const { visit(f, *this); }
+		/// \brief calls f(field, record, other_record) for each of the records
+		template <typename F> void for_each(const Rays& other, F&& f) {
+			visit(f, *this, other);
+		}
+
+	private:
+		template <typename F, typename... R> static void visit(F& f, R&... r) {
+			f(kX, r._x...);
+			f(kY, r._y...);
+			f(kZ, r._z...);
+			f(kDX, r._dx...);
+			f(kDY, r._dy...);
+			f(kDZ, r._dz...);
+			f(kSX, r._sx...);
+			f(kSY, r._sy...);
+			f(kSZ, r._sz...);
+			f(kSPolAx, r._sPolAx...);
+			f(kSPolAy, r._sPolAy...);
+			f(kSPolAz, r._sPolAz...);
+			f(kSPolPh, r._sPolPh...);
+			f(kPPolAx, r._pPolAx...);
+			f(kPPolAy, r._pPolAy...);
+			f(kPPolAz, r._pPolAz...);
+			f(kPPolPh, r._pPolPh...);
+			f(kWavelength, r._wavelength...);
+			f(kTime, r._time...);
+			f(kWeight, r._weight...);
+			f(kId, r._id...);
+			f(kStatus, r._status...);
+		}
 	}; // end of Rays class
 
+	/** \brief transformation applied in place to each chunk, see set_read_pipeline() and
+	 * make_pipeline() in ray_pipeline.hh
+	 */
+	typedef std::function<void(Rays&)> transform_t;
+
 public:
 	/**\brief constructor
 	 *
@@ -232,6 +402,49 @@ public:
 	                "" ///< [optional] current component name along the beamline
 	);
 
+	~openPMD_io();
+
+	/** \brief number of rays written or read at once
+	 *
+	 * Larger chunks reduce the number of requests to the backend at the cost of memory. It
+	 * should be called before init_write() or init_read().
+	 */
+	void set_chunk_size(size_t chunk_size);
+	size_t get_chunk_size(void) const { return _chunk_size; } ///< number of rays at once
+
+	/***************************************************************/
+	/// \name Streaming mode
+	///@{
+	/** \brief enable the step-based streaming mode
+	 *
+	 * In streaming mode every chunk of rays is written as a separate openPMD step
+	 * (iteration) through the Series::writeIterations() API, and read back one step at a time
+	 * through Series::readIterations(). With the ADIOS2 SST engine (or BP4 in streaming mode) a
+	 * reader can consume the rays while the writer is still producing them.
+	 *
+	 * It must be called before init_write() or init_read().
+	 *
+	 * \param[in] streaming : true to enable the streaming mode
+	 * \param[in] engine : [optional] ADIOS2 engine ("sst", "bp4"), by default it is deduced by
+	 * openPMD from the filename extension
+	 */
+	void set_streaming(bool streaming, std::string engine = "");
+
+	/// \brief returns true if the streaming mode is enabled
+	bool is_streaming(void) const { return _isStreaming; }
+
+	/** \brief tune the openPMD backend: HDF5 chunking, ADIOS2 engine, aggregation, buffers
+	 *
+	 * The options are applied to the openPMD::Series and to the datasets of the rays. The
+	 * engine of set_streaming(), if any, has precedence over the one of the configuration.
+	 * The HDF5 alignment is set by openPMD from the OPENPMD_HDF5_ALIGNMENT environment
+	 * variable.
+	 *
+	 * It must be called before init_write() or init_read().
+	 */
+	void set_backend_config(const backend_config& config) { _backend = config; }
+	///@}
+
 	/***************************************************************/
 	/// \name Writing mode
 	///@{
@@ -252,20 +465,102 @@ public:
 
 	/** \brief declare the ray particle species in the file
 	 *
-	 * This function must be called each time the particle species are changed and for each new
-	 * iteration.
+	 * This function must be called for each particle species to be written in the file: each
+	 * of them has its own buffer and its own maximum number of rays. The last declared species
+	 * becomes the current one, used by trace_write(Ray) and write_chunk().
 	 *
 	 **/
 	void
 	init_rays(std::string particle_species, unsigned long long int n_rays, unsigned int iter);
 
-	/// \brief save ray properties for further writing to file by save_write()
+	/// \brief save ray properties of the current particle species for further writing to file
 	void trace_write(Ray this_ray);
 
-	/** \brief Flushes the output to file before closing it
+	/** \brief save ray properties of the given particle species for further writing to file
 	 *
+	 * The particle species must have been declared with init_rays(). When the buffer of one
+	 * species is full, the rays of all the species are written to file at once.
+	 */
+	void trace_write(const std::string& particle_species, Ray this_ray);
+
+	/** \brief Flushes the output of all the particle species to file before closing it
+	 *
+	 * Only the data and the numParticles attribute are written at each flush. The attributes
+	 * summarizing all the rays (minValue, maxValue, population control and sorting) are
+	 * written once, when the file is closed by the destructor or by the next init_write() or
+	 * init_read().
 	 **/
 	void save_write(void);
+
+	/** \brief writes the pending rays and the summary attributes of all the particle species
+	 *
+	 * This is what the destructor does, but the destructor can only print the errors on
+	 * std::cerr: call it explicitly to get them as exceptions. It does nothing if there is
+	 * nothing left to write.
+	 */
+	void close_write(void);
+
+	/** \brief write a whole chunk of rays of the current particle species, bypassing
+	 * trace_write()
+	 *
+	 * The rays already queued by trace_write() are written first. The records of the chunk
+	 * can be views on memory owned by the caller (e.g. a memory mapped file): they are written
+	 * without being copied.
+	 */
+	void write_chunk(const Rays& rays);
+
+	/** \brief cap the number of rays written for the current particle species
+	 *
+	 * The rays passed to trace_write() go through Russian roulette (and optionally
+	 * splitting) so that the number of rays written stays within the n_rays given to
+	 * init_write() or init_rays(), while keeping the total weight unbiased. See
+	 * raytracing::population_control for the details. The factors applied are stored as
+	 * attributes of the particle species (populationControlFactor, ...).
+	 *
+	 * It must be called after init_write() or init_rays(), before the first trace_write().
+	 * Rays written with write_chunk() are not affected.
+	 *
+	 * \param[in] n_generated : expected number of rays passed to trace_write()
+	 * \param[in] splitting : [optional] split the rays with a high weight
+	 * \param[in] seed : [optional] seed of the random number generator
+	 */
+	void set_population_control(unsigned long long int n_generated, bool splitting = false,
+	                            unsigned long long int seed = 0);
+
+	/** \brief sort the rays of each chunk before writing them
+	 *
+	 * Rays close in phase space end up close in the file, which improves the compression
+	 * ratio and limits the number of chunks to be read for a region of interest. The key is
+	 * stored in the sortKey attribute of the particle species. Except in streaming mode, the
+	 * position of each chunk in the file is stored in the sortChunkOffset record, and the
+	 * range of the sorted fields in each chunk in the sortChunkMinValue and sortChunkMaxValue
+	 * records, with a component per sorted field (e.g. x and y). These records have one value
+	 * per chunk instead of one per ray, and are written as datasets since their size grows
+	 * with the number of chunks.
+	 *
+	 * It applies to all the particle species, for the chunks written from then on.
+	 */
+	void set_sort(sort_key_t key);
+
+	/** \brief transform the rays of each chunk before writing them
+	 *
+	 * The pipeline (see make_pipeline()) runs once per chunk, on the rays passed to
+	 * trace_write() or write_chunk(): the rays it filters out are not written, and the
+	 * min-max attributes are those of the transformed rays. It applies to all the particle
+	 * species; an empty function removes it. The rays already passed to trace_write() are
+	 * written first, with the previous pipeline.
+	 */
+	void set_write_pipeline(transform_t pipeline);
+
+	/** \brief set an attribute of the current particle species, e.g. provenance information
+	 *
+	 * Not available in streaming mode, where the particle species is declared in each step.
+	 */
+	template <typename T> void set_attribute(const std::string& name, const T& value) {
+		if (_isStreaming)
+			throw std::runtime_error("Attributes cannot be set in streaming mode");
+		species_pmd(_particle_species).setAttribute(name, value);
+	}
 	///@}
 
 	/***************************************************************/
@@ -291,6 +586,147 @@ public:
 	 */
 	Ray trace_read(void);
 
+	/** \brief check if all the rays have been read
+	 *
+	 * In streaming mode the number of rays is not known in advance: this method waits for the
+	 * next step to be published by the writer and returns true only when the stream has been
+	 * closed.
+	 *
+	 * \return true if all the requested rays have already been returned by trace_read()
+	 */
+	bool is_read_finished(void);
+
+	/// number of rays of each particle species in each iteration
+	typedef std::map<unsigned int, std::map<std::string, unsigned long long int>> file_index_t;
+
+	/** \brief number of rays of each particle species in each iteration of the file
+	 *
+	 * The files written by this API have a rayIndex attribute giving the content without
+	 * parsing any iteration. For the other files, all the iterations are parsed. It does not
+	 * change the reading or writing state, and can be called before init_read().
+	 */
+	file_index_t file_index(void) const;
+
+	/** \brief move the reading position to the given ray
+	 *
+	 * The next ray returned is the one at the given index in the file. Together with the
+	 * n_rays of init_read(), it allows to read any range of rays. Not available in streaming
+	 * and sampled modes.
+	 */
+	void seek(unsigned long long int ray);
+
+	/** \brief load only the given fields of the rays, e.g. field_mask({kX, kY, kWeight})
+	 *
+	 * The other records of the chunks are left empty and the rays returned by trace_read()
+	 * have the default values for them, which cuts the I/O and the memory when only a few
+	 * properties are needed. With sampled reading the weights are always loaded. It must be
+	 * called before init_read().
+	 */
+	void set_projection(field_mask_t fields) { _projection = fields; }
+
+	/** \brief transform the rays of each chunk after loading them
+	 *
+	 * The pipeline (see make_pipeline()) runs once per chunk, before the rays are returned by
+	 * trace_read() or read_chunk(), so the consumer only sees the rays kept by its filters.
+	 * The chunks shared with other processes or memory mapped are copied first. An empty
+	 * function removes it.
+	 */
+	void set_read_pipeline(transform_t pipeline) { _read_pipeline = std::move(pipeline); }
+
+	/** \brief read the next chunk of rays, bypassing trace_read()
+	 *
+	 * The rays are returned column by column in the records of the Rays object, which stay
+	 * valid until the next call. The chunk is empty when all the rays have been read. The
+	 * repeat parameter of init_read() is ignored, and the two reading methods should not be
+	 * mixed.
+	 */
+	const Rays& read_chunk(void);
+
+	/** \brief share the chunks read from file with the other processes of the node
+	 *
+	 * When enabled, each chunk is looked up in a POSIX shared memory cache before being
+	 * loaded from file. The first process reading a chunk puts it in the cache, the others
+	 * use it without copying it. There is one cache per file, iteration, particle species and
+	 * projection, kept as long as a process reading it is alive: the processes do not need
+	 * to read the same chunks at the same time to share them.
+	 *
+	 * It applies only to the normal reading mode (not to streaming, follow, sampled or
+	 * native files). It must be called before init_read().
+	 *
+	 * \param[in] enable : true to enable the cache
+	 * \param[in] persistent : [optional] keep the cache in shared memory (/dev/shm) when no
+	 * process is using it anymore, so that it can be reused by the next processes, until
+	 * purge_shared_cache()
+	 */
+	void set_shared_cache(bool enable, bool persistent = false);
+
+	/** \brief remove the shared memory caches of a file, or all of them if empty
+	 *
+	 * The processes reading from them keep their copy, the next ones load the file again.
+	 * \return the number of caches (iterations, particle species or projections) removed
+	 */
+	static unsigned int purge_shared_cache(const std::string& filename = "");
+
+	/** \brief keep the whole particle species in memory and read it from there
+	 *
+	 * When the rays to be loaded (see set_projection()) fit in the budget, init_read() loads
+	 * all of them at once and trace_read() and read_chunk() are then served from memory. The
+	 * buffer is kept by the object: the next init_read() of the same file, iteration,
+	 * particle species and projection does not access the file again, which is useful when
+	 * a small source is read many times. Larger files are read as usual.
+	 *
+	 * With cycle, the reading restarts at the first ray after the last: init_read() accepts
+	 * any n_rays, 0 meaning that the reading never ends.
+	 *
+	 * It applies only to the normal reading mode (not to streaming, follow, sampled or native
+	 * files). It must be called before init_read().
+	 *
+	 * \param[in] budget : maximum size of the buffer in bytes, 0 to disable the mode and
+	 * release the buffer
+	 * \param[in] cycle : [optional] restart at the first ray after the last
+	 */
+	void set_replay(size_t budget, bool cycle = false);
+
+	/** \brief read a random subset of the rays instead of the first ones
+	 *
+	 * With kUniform or kStratified, init_read() selects n_rays rays out of those in the file
+	 * (all of them if n_rays is 0) instead of the first n_rays. The selection is reproducible
+	 * for a given seed. The rays are returned in the order of the file, and their weight is
+	 * multiplied by numParticles / n_rays so that the intensities are preserved.
+	 *
+	 * With kWeighted, the rays are drawn with replacement with a probability proportional to
+	 * their weight, using an alias table built in one pass over the weight column: n_rays
+	 * can then be larger than numParticles. All the rays returned have the same weight, the
+	 * total weight divided by n_rays, so that the downstream simulation spends its time where
+	 * the intensity is. For very large files the alias table is built on the weight sums of
+	 * blocks of rays, and the ray is then drawn within the block.
+	 *
+	 * The selected rays are read by chunks, with a single loadChunk per record for rays that
+	 * are close in the file. It must be called before init_read(), and it does not apply to
+	 * the streaming and follow modes.
+	 *
+	 * \param[in] mode : selection of the rays
+	 * \param[in] seed : [optional] seed of the random number generator
+	 */
+	void set_sampling(sampling_t mode, unsigned long long int seed = 0);
+
+	/** \brief enable the "follow" reading mode, to read a file that is still being written
+	 *
+	 * In follow mode, once all the rays committed by the writer have been read,
+	 * is_read_finished() re-opens the file and re-reads the committed numParticles, waiting for
+	 * new chunks to be published. Reading stops when the writer has filled all the declared
+	 * rays, when the requested number of rays has been read, or when no new ray has been
+	 * committed for timeout seconds.
+	 *
+	 * It must be called before init_read(). With HDF5 the file locking should be disabled
+	 * (HDF5_USE_FILE_LOCKING=FALSE) to open a file while it is being written.
+	 *
+	 * \param[in] follow : true to enable the follow mode
+	 * \param[in] timeout : [optional] seconds to wait for new rays before giving up
+	 * \param[in] poll : [optional] seconds between two checks of the committed rays
+	 */
+	void set_follow(bool follow, double timeout = 60., double poll = 1.);
+
 	void set_gravity_direction(float x, float y, float z);
 
 	void get_gravity_direction(float* x, float* y, float* z);
@@ -298,7 +734,98 @@ public:
 	void set_horizontal_direction(float* x, float* y, float* z);
 	///@}
 private:
+	friend class ray_session;
+	// initializes the writer of a component of a session, in its own iteration of the series
+	void init_component(std::shared_ptr<openPMD::Series> series, ray_session* session,
+	                    const std::string& component, std::string particle_species,
+	                    unsigned long long int n_rays, unsigned int iter);
+	// queues the pending rays of all the particle species, returns false if there are none
+	bool queue_pending(void);
+	// updates the numParticles commit markers and empties the buffers, once flushed
+	void commit_pending(void);
+
+	// loads the next chunk and runs the read pipeline, until some rays are kept
 	void load_chunk(void);
+	// loads the next chunk from the source
+	void load_source(void);
+	void load_step(void);
+	void follow_commits(void);
+
+	void load_columnar(void);
+	void load_sampled(void);
+	void load_weights(std::uint64_t begin, std::uint64_t count, float* weights);
+	std::vector<std::uint64_t> sample_weighted(std::uint64_t n_available, std::uint64_t n_rays);
+	// selects the rays to be read, returns the number of rays selected
+	unsigned long long int init_sampling(unsigned long long int n_available,
+	                                     unsigned long long int n_rays);
+	bool load_shared(openPMD::Extent& chunk_size);
+	void load_replay(void);
+	// starts reading from the in-memory buffer, returns the number of rays to be read
+	unsigned long long int init_replay(unsigned long long int n_rays);
+
+	/** \struct species_plan
+	 * \brief openPMD handles of a particle species and of its record components
+	 *
+	 * The handles are resolved once, when the species is declared or opened, instead of
+	 * looking up the records by name at each chunk.
+	 */
+	struct species_plan {
+		explicit species_plan(openPMD::ParticleSpecies& rays);
+		openPMD::ParticleSpecies species;
+		std::vector<openPMD::RecordComponent> components; ///< indexed by field_t
+	};
+
+	/** \struct species_buffer
+	 * \brief rays of one particle species waiting to be written
+	 */
+	struct species_buffer {
+		Rays rays;              ///< chunk being filled, and min-max of all the rays written
+		openPMD::Offset offset; ///< position of the next chunk in the file
+		unsigned long long int nrays    = 0; ///< number of rays written
+		unsigned long long int max_rays = 0; ///< size of the datasets
+		population_control population;       ///< roulette and splitting before writing
+		Rays sorted;                         ///< chunk sorted before writing
+		Rays staged; ///< chunk being filled or copied, before the write pipeline
+		std::vector<unsigned long long int> sort_offsets; ///< first ray of each sorted chunk
+		std::map<field_t, std::vector<float>> sort_min, sort_max; ///< per-chunk ranges
+		std::unique_ptr<species_plan> plan;  ///< handles of the current iteration or step
+	};
+	// a flush writes the queued chunks of all the particle species at once
+	void begin_flush(void);
+	void queue_rays(const std::string& particle_species, species_buffer& sp, const Rays& chunk);
+	void end_flush(void);
+
+	// store/load all the records of a chunk
+	static void store_rays(species_plan& plan, const Rays& chunk, openPMD::Offset& offset,
+	                       openPMD::Extent& extent);
+	static void load_rays(species_plan& plan, Rays& chunk, openPMD::Offset& offset,
+	                      openPMD::Extent& chunk_size, field_mask_t fields);
+	// set the attributes summarizing the rays written so far: min-max values, population
+	// control, sorting. In file mode they are written only once, when closing.
+	void store_summary(species_buffer& sp);
+	void store_gravity_direction(openPMD::ParticleSpecies& rays);
+	// runs the write pipeline on the staged chunk and adds its range to the summary
+	void transform_staged(species_buffer& sp);
+	// sorts the chunk, returns the chunk to be written
+	const Rays& sort_chunk(species_buffer& sp, const Rays& chunk);
+	// declare the datasets of the particle species for n_rays
+	void declare_rays(openPMD::ParticleSpecies& rays, std::string particle_species,
+	                  unsigned long long int n_rays);
+
+	// returns the JSON options for the openPMD::Series
+	std::string series_options(bool isWriteMode) const;
+	// returns the JSON options for the datasets of n_rays rays
+	std::string dataset_options(unsigned long long int n_rays) const;
+
+	// returns the openPMD record component of the field
+	static openPMD::RecordComponent& record_pmd(openPMD::ParticleSpecies& rays, field_t field);
+
+	template <typename T>
+	static void save_write_single(openPMD::RecordComponent& data, const Rays::Record<T>& rec,
+	                              openPMD::Offset& offset, openPMD::Extent& extent);
+	template <typename T>
+	static void read_single(openPMD::RecordComponent& data, Rays::Record<T>& rec,
+	                        openPMD::Offset& offset, openPMD::Extent& chunk_size);
 
 private:
 	// parameters defined at construction
@@ -308,31 +835,87 @@ private:
 	std::string _instrument_name;
 	std::string _name_current_component;
 	unsigned int _i_repeat, _n_repeat;
-	unsigned long long int _nrays, _max_allowed_rays;
+	size_t _chunk_size;
+	unsigned long long int _nrays;
 
 	// internal usage
 	//	openPMD::Access _access_mode;
 	openPMD::Offset _offset;
 	bool _isWriteMode;
-	std::unique_ptr<openPMD::Series> _series;
+	std::shared_ptr<openPMD::Series> _series; // shared by the writers of a ray_session
 	Rays _rays;
+	std::unique_ptr<species_plan> _read_plan; // handles of the particle species being read
 	Ray _last_ray;
 	unsigned int _iter;
 	std::string _particle_species;
 
+	sort_key_t _sort_key; // order of the rays in the chunks written
+
+	transform_t _read_pipeline, _write_pipeline; // set_read_pipeline(), set_write_pipeline()
+
+	// fields requested with set_projection() and fields effectively loaded
+	field_mask_t _projection, _read_fields;
+
+	ray_session* _session; // session owning the series, nullptr if none
+
+	// write buffers, one per particle species
+	std::map<std::string, species_buffer> _write_species;
+	species_buffer* _write_current; // last species used by trace_write()
+	std::string _write_current_name;
+
+	// streaming mode
+	bool _isStreaming;
+	std::string _stream_engine;
+	unsigned long long int _nsteps;                    // number of steps written or read
+	openPMD::Iteration* _stream_step;                  // current step, nullptr if none
+	std::unique_ptr<openPMD::SeriesIterator> _stream_it, _stream_end;
+	float _gravity[Ray::DIM];                          // repeated in each written step
+
+	backend_config _backend;
+
+	// native columnar file, memory mapped when reading
+	std::unique_ptr<columnar_file> _columnar;
+
+	// shared memory cache of the chunks
+	bool _isSharedCache, _isSharedCachePersistent;
+	std::string _cache_key; // file, iteration and particle species
+	std::unique_ptr<shm_cache> _shared_cache;
+
+	// sampled reading
+	sampling_t _sampling;
+	unsigned long long int _sampling_seed;
+	std::vector<std::uint64_t> _sample; // indices of the selected rays, in increasing order
+	double _sample_factor; // correction of the weights, or weight of the rays with kWeighted
+
+	// in-memory replay
+	size_t _replay_budget; // bytes, 0 when disabled
+	bool _replay_cycle, _isReplaying;
+	Rays _replay;            // all the rays of the particle species
+	std::string _replay_key; // file, iteration, particle species and fields of _replay
+
+	// follow mode
+	bool _isFollowing;
+	double _follow_timeout, _follow_poll;              // seconds
+	unsigned long long int _follow_limit;              // max number of rays to read, 0=ALL
+
 	//------------------------------ set of helper methods
-	inline openPMD::Iteration& iter_pmd(unsigned int iter) { return _series->iterations[iter]; }
+	inline openPMD::Iteration& iter_pmd(unsigned int iter) {
+		if (_stream_step != nullptr) return *_stream_step;
+		return _series->iterations[iter];
+	}
 
 	// returns the current particle species from the current iteration
 	inline openPMD::ParticleSpecies& rays_pmd(void) {
-		auto i = iter_pmd(_iter);
+		auto& i = iter_pmd(_iter);
 		return i.particles[_particle_species];
 	}
 
+	// opens the current iteration and returns the current particle species, when reading
+	openPMD::ParticleSpecies& open_species(void);
+
 	// returns the given particle species from the current iteration
-	inline openPMD::ParticleSpecies& rays_pmd(std::string particle_species) {
-		_particle_species = particle_species;
-		auto i            = iter_pmd(_iter);
+	inline openPMD::ParticleSpecies& species_pmd(const std::string& particle_species) {
+		auto& i = iter_pmd(_iter);
 		return i.particles[particle_species];
 	}
 
@@ -341,7 +924,8 @@ private:
 	 * \param[in] dims : Unit dimensions
 	 * \param[in]
 	 */
-	void init_ray_prop(std::string name,          ///< name : name of the field/property
+	void init_ray_prop(openPMD::ParticleSpecies& rays, ///< particle species
+	                   std::string name,          ///< name : name of the field/property
 	                   openPMD::Dataset& dataset, ///< dataset definition
 	                   bool isScalar,             ///< true if it is a scalar
 	                   std::map<openPMD::UnitDimension, double> const& dims =
@@ -0,0 +1,100 @@
+#ifndef OPENPMD_IO_C_H
+#define OPENPMD_IO_C_H
+/**\file
+ * \brief C interface of the openPMD ray tracing API, for McStas and other C or Fortran codes
+ *
+ * The file is accessed through an opaque handle. The rays are exchanged in batches, as
+ * arrays of n values per property, so that there is no per-ray call across the interface.
+ * The positions and the times are multiplied by the scale factors of
+ * openpmd_rays_set_units() when written, and divided by them when read: the file always
+ * stores cm and ms. The wavelengths are given in Å, and stored in m.
+ *
+ * The functions returning an int return a negative value on error, and the functions
+ * returning a handle return NULL: the message is then given by openpmd_rays_error().
+ */
+#include "export.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \brief opaque handle on a ray file being written or read */
+typedef struct openpmd_rays openpmd_rays;
+
+/** \brief creates a file to write n_rays rays of a particle species (PDG ID)
+ * n_rays is the maximum number of rays, see openPMD_io::init_write()
+ */
+openPMDraytrace_EXPORT openpmd_rays*
+openpmd_rays_open_write(const char* filename, const char* mc_code_name,
+                        const char* particle_species, unsigned long long n_rays,
+                        unsigned int iter);
+
+/** \brief opens a file to read the rays of a particle species (PDG ID)
+ * \param[in] n_rays : maximum number of rays to read, 0 for all
+ * \param[out] n_available : [optional] number of rays to be read
+ */
+openPMDraytrace_EXPORT openpmd_rays*
+openpmd_rays_open_read(const char* filename, const char* particle_species, unsigned int iter,
+                       unsigned long long n_rays, unsigned long long* n_available);
+
+/** \brief writes the pending rays and releases the handle
+ * The handle is released even when writing the rays fails.
+ */
+openPMDraytrace_EXPORT int openpmd_rays_close(openpmd_rays* h);
+
+/** \brief factors converting the positions into cm and the times into ms
+ * e.g. 100 and 1000 for McStas (m and s). The default is 1 and 1.
+ */
+openPMDraytrace_EXPORT int openpmd_rays_set_units(openpmd_rays* h, double length_to_cm,
+                                                  double time_to_ms);
+
+/** \brief sets the direction of gravity, when writing */
+openPMDraytrace_EXPORT int openpmd_rays_set_gravity(openpmd_rays* h, double x, double y,
+                                                    double z);
+
+/** \brief writes n rays given by their unit direction, wavelength [Å] and time
+ * id can be NULL, the rays are then numbered 0. The rays are buffered and written to file by
+ * chunks (see openPMD_io::set_chunk_size()), so an error writing them can be returned by a
+ * later call or by openpmd_rays_close().
+ */
+openPMDraytrace_EXPORT int
+openpmd_rays_write(openpmd_rays* h, size_t n, const double* x, const double* y, const double* z,
+                   const double* dx, const double* dy, const double* dz,
+                   const double* wavelength, const double* time, const double* weight,
+                   const unsigned long long* id);
+
+/** \brief writes n neutrons given by their velocity [m/s], as in McStas
+ * The spin sx, sy, sz can be NULL. The rays are buffered as in openpmd_rays_write().
+ */
+openPMDraytrace_EXPORT int
+openpmd_rays_write_neutrons(openpmd_rays* h, size_t n, const double* x, const double* y,
+                            const double* z, const double* vx, const double* vy,
+                            const double* vz, const double* t, const double* p,
+                            const double* sx, const double* sy, const double* sz);
+
+/** \brief reads up to n rays, with the wavelength in Å
+ * The arrays can be NULL for the properties not needed.
+ * \return the number of rays read, 0 when all the rays have been read
+ */
+openPMDraytrace_EXPORT long long
+openpmd_rays_read(openpmd_rays* h, size_t n, double* x, double* y, double* z, double* dx,
+                  double* dy, double* dz, double* wavelength, double* time, double* weight,
+                  unsigned long long* id);
+
+/** \brief reads up to n neutrons with their velocity [m/s], as in McStas
+ * The arrays can be NULL for the properties not needed.
+ * \return the number of rays read, 0 when all the rays have been read
+ */
+openPMDraytrace_EXPORT long long
+openpmd_rays_read_neutrons(openpmd_rays* h, size_t n, double* x, double* y, double* z,
+                           double* vx, double* vy, double* vz, double* t, double* p,
+                           double* sx, double* sy, double* sz);
+
+/** \brief message of the last error of the calling thread, empty if none */
+openPMDraytrace_EXPORT const char* openpmd_rays_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
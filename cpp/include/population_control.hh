@@ -0,0 +1,68 @@
+#ifndef POPULATION_CONTROL_HH
+#define POPULATION_CONTROL_HH
+///\file
+#include <random>
+
+namespace raytracing {
+
+/** \class population_control
+ * \brief weight-preserving Russian roulette and splitting of the rays being written
+ *
+ * The number of rays written is kept within a budget, whatever the number of rays generated
+ * by the simulation. Each ray of weight w is given an importance
+ *
+ *   r = f * w / <w>
+ *
+ * where <w> is the mean weight of the rays seen so far and f = target / n_generated is the
+ * population control factor. The ray is written as floor(r) or floor(r)+1 copies (with
+ * probability r - floor(r)) of weight w / r: low-weight rays are killed by Russian roulette,
+ * high-weight rays are split if splitting is enabled. The expected total weight is the one of
+ * the generated rays, and the expected number of rays written is the target.
+ *
+ * The target is lower than the budget by 3 standard deviations of the number of rays written,
+ * so that the budget is very unlikely to be exceeded.
+ */
+class population_control {
+public:
+	population_control();
+
+	/** \brief enable the population control
+	 * \param[in] budget : maximum number of rays to be written
+	 * \param[in] n_generated : expected number of rays generated by the simulation
+	 * \param[in] splitting : split the rays with high weight
+	 * \param[in] seed : seed of the random number generator
+	 */
+	void init(unsigned long long int budget, unsigned long long int n_generated,
+	          bool splitting, unsigned long long int seed);
+
+	bool is_enabled(void) const { return _enabled; }
+
+	/** \brief decides how many copies of the ray should be written
+	 * \param[in] weight : weight of the generated ray
+	 * \param[out] copy_weight : weight of each copy
+	 * \return the number of copies, 0 if the ray is killed
+	 */
+	unsigned int sample(float weight, float* copy_weight);
+
+	/// \name Statistics, stored as attributes of the particle species
+	///@{
+	double factor(void) const { return _factor; }              ///< population control factor
+	bool splitting(void) const { return _splitting; }          ///< splitting enabled
+	unsigned long long int generated(void) const { return _n_in; } ///< number of rays sampled
+	unsigned long long int written(void) const { return _n_out; }  ///< number of copies
+	double weight_in(void) const { return _weight_in; }   ///< sum of the weights sampled
+	double weight_out(void) const { return _weight_out; } ///< sum of the weights of the copies
+	///@}
+
+private:
+	bool _enabled, _splitting;
+	double _factor;
+	unsigned long long int _n_in, _n_out;
+	double _weight_in, _weight_out;
+	double _abs_weight_in; // for the mean weight
+	std::mt19937_64 _rng;
+	std::uniform_real_distribution<double> _uniform;
+};
+
+} // namespace raytracing
+#endif
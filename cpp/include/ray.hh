@@ -5,7 +5,8 @@
 #include <ostream>
 
 namespace raytracing {
-constexpr double V2W = 3.956034e-07; // m^2/
+constexpr double V2W   = 3.956034e-07; // m^2/
+constexpr double kVS2E = 5.22703725e-6; ///< Convert (v[m/s])**2 to E[meV]
 // enum particleStatus_t : int { kDead = 0, kAlive = 1 };
 
 /** \typedef particleStatus_t
@@ -0,0 +1,68 @@
+#ifndef RAY_ARROW_HH
+#define RAY_ARROW_HH
+///\file
+#include "openPMD_io.hh"
+#include <arrow/api.h>
+#include <memory>
+#include <string>
+
+namespace raytracing {
+
+/** \name Apache Arrow interop
+ *
+ * Optional module, built with -DOPENPMDRAYTRACE_ARROW=ON.
+ *
+ * The rays are exchanged with the Arrow ecosystem (pyarrow, polars, DuckDB...) as record
+ * batches with one column per loaded field of the chunk, named as the getters of the Ray class
+ * (see get_field_info()): float32 for the properties, uint64 for the id and int32 for the
+ * status. The columns have no null values.
+ */
+///@{
+
+/// \brief schema of the record batches with all the fields
+std::shared_ptr<arrow::Schema> arrow_schema(void);
+
+/** \brief a chunk as a record batch, without copying it
+ *
+ * The columns wrap the buffers of the records (see openPMD_io::read_chunk()), so the batch
+ * should not be used after the chunk is modified or the next chunk is read. The records not
+ * loaded (see openPMD_io::set_projection()) are left out of the batch.
+ */
+std::shared_ptr<arrow::RecordBatch> to_record_batch(const openPMD_io::Rays& rays);
+
+/** \brief the columns of a record batch as a chunk, to be passed to openPMD_io::write_chunk()
+ *
+ * The records of the chunk are views on the columns, which should stay valid as long as the
+ * chunk is used: only the min-max values are computed. The fields missing in the batch are
+ * filled with the values of a default Ray. The columns of the batch should have the types of
+ * arrow_schema(), without null values, otherwise an exception is thrown.
+ */
+void from_record_batch(const arrow::RecordBatch& batch, openPMD_io::Rays& rays);
+
+/** \brief writes a record batch with the current particle species of the writer
+ * It is a shortcut for from_record_batch() and openPMD_io::write_chunk().
+ */
+void write_record_batch(openPMD_io& writer, const arrow::RecordBatch& batch);
+
+/** \brief stream a particle species of an openPMD file into an Arrow IPC file, chunk by chunk
+ *
+ * Each chunk of the reader is written as one record batch, without being copied in between.
+ * The rays are read in chunks of chunk_size rays.
+ */
+void openPMD_to_arrow(const std::string& pmd_filename,     ///< input openPMD file
+                      const std::string& particle_species, ///< PDG ID of the particles
+                      unsigned int iter,                   ///< openPMD iteration
+                      const std::string& arrow_filename,   ///< output Arrow IPC file
+                      size_t chunk_size = 1 << 20          ///< number of rays per batch
+);
+
+/// \brief writes the record batches of an Arrow IPC file as a particle species of an openPMD file
+void arrow_to_openPMD(const std::string& arrow_filename,   ///< input Arrow IPC file
+                      const std::string& pmd_filename,     ///< output openPMD file
+                      const std::string& particle_species, ///< PDG ID of the particles
+                      unsigned int iter = 1                ///< openPMD iteration
+);
+///@}
+
+} // namespace raytracing
+#endif
@@ -0,0 +1,134 @@
+#ifndef RAY_BUFFER_POOL_HH
+#define RAY_BUFFER_POOL_HH
+///\file
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <utility>
+
+namespace raytracing {
+
+/** \enum huge_pages_t
+ * \brief backing of the pooled buffers
+ */
+enum huge_pages_t {
+	kNoHugePages = 0,      ///< regular pages
+	kTransparentHugePages, ///< regular mapping advised for transparent huge pages (Linux)
+	kHugeTLBPages ///< explicit huge pages (MAP_HUGETLB), regular pages if none is reserved
+};
+
+/** \struct buffer_pool_options
+ * \brief options of the buffer_pool
+ */
+struct buffer_pool_options {
+	huge_pages_t huge_pages = kNoHugePages; ///< backing of the new buffers
+	/** bytes of released buffers kept for reuse, beyond which they are returned to the system.
+	 * With 0, the cache is bounded by the largest amount of memory used at once by the
+	 * buffers (i.e. the chunks alive at the same time), reset by trim().
+	 */
+	size_t max_cached = 0;
+};
+
+/** \class buffer_pool
+ * \brief process-wide pool of the column buffers of the rays
+ *
+ * The buffers of the records of openPMD_io::Rays are page-aligned anonymous mappings (heap
+ * allocations on the systems without mmap()) taken from this pool and given back to it when
+ * released, so that the buffers of a chunk are recycled across flushes, loads and openPMD_io
+ * instances instead of being mapped and zero-filled by the system each time. A released
+ * buffer is reused for a request between half its size and its size. Buffers smaller than
+ * kMinPooled come from the heap.
+ *
+ * It is thread safe.
+ */
+class buffer_pool {
+public:
+	static constexpr size_t kMinPooled = 1 << 16; ///< smallest buffer taken from the pool
+
+	/// \brief the pool of the process
+	static buffer_pool& instance(void);
+
+	/// \brief sets the options, applied to the buffers acquired afterwards
+	void set_options(const buffer_pool_options& options);
+	buffer_pool_options options(void) const;
+
+	/// \brief returns an uninitialized buffer of at least the given size, aligned to a page
+	void* acquire(size_t bytes);
+	/// \brief gives back a buffer returned by acquire() with the same size
+	void release(void* p, size_t bytes) noexcept;
+
+	/// \brief returns the buffers kept for reuse to the system
+	void trim(void);
+
+	/// \name Statistics
+	///@{
+	size_t cached_bytes(void) const;      ///< bytes kept for reuse
+	size_t mapped_bytes(void) const;      ///< bytes in use or kept for reuse
+	unsigned long long int n_mapped(void) const; ///< number of buffers mapped from the system
+	unsigned long long int n_reused(void) const; ///< number of buffers reused
+	///@}
+
+	buffer_pool(const buffer_pool&) = delete;
+	buffer_pool& operator=(const buffer_pool&) = delete;
+
+private:
+	buffer_pool() = default;
+	void unmap(void* p, size_t length) noexcept;
+
+	mutable std::mutex _mutex;
+	buffer_pool_options _options;
+	std::multimap<size_t, void*> _free;       // released buffers by length
+	std::unordered_map<void*, size_t> _used; // length of the buffers in use
+	size_t _cached = 0, _mapped = 0;
+	size_t _peak = 0; // largest number of bytes in use at once
+	unsigned long long int _n_mapped = 0, _n_reused = 0;
+};
+
+/** \class pool_allocator
+ * \brief allocator of the record buffers: memory from the buffer_pool, values left
+ * uninitialized by resize() as they are overwritten anyway when loading or filling a chunk
+ */
+template <typename T> class pool_allocator {
+public:
+	typedef T value_type;
+
+	pool_allocator() noexcept = default;
+	template <typename U> pool_allocator(const pool_allocator<U>&) noexcept {}
+
+	T* allocate(size_t n) {
+		size_t bytes = n * sizeof(T);
+		if (bytes >= buffer_pool::kMinPooled)
+			return static_cast<T*>(buffer_pool::instance().acquire(bytes));
+		return static_cast<T*>(::operator new(bytes));
+	}
+
+	void deallocate(T* p, size_t n) noexcept {
+		size_t bytes = n * sizeof(T);
+		if (bytes >= buffer_pool::kMinPooled)
+			buffer_pool::instance().release(p, bytes);
+		else
+			::operator delete(p);
+	}
+
+	/// default-initialization: no zero-filling of the arithmetic types
+	template <typename U> void construct(U* p) { ::new (static_cast<void*>(p)) U; }
+	template <typename U, typename... Args> void construct(U* p, Args&&... args) {
+		::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+	}
+};
+
+template <typename T, typename U>
+bool
+operator==(const pool_allocator<T>&, const pool_allocator<U>&) noexcept {
+	return true;
+}
+template <typename T, typename U>
+bool
+operator!=(const pool_allocator<T>&, const pool_allocator<U>&) noexcept {
+	return false;
+}
+
+} // namespace raytracing
+#endif
@@ -0,0 +1,129 @@
+#ifndef RAY_COLUMNAR_HH
+#define RAY_COLUMNAR_HH
+///\file
+#include "ray_fields.hh"
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace raytracing {
+
+/** \class columnar_file
+ * \brief native on-disk layout of the rays, memory mapped for zero-copy reading
+ *
+ * The file is made of a fixed size header followed by one column per ray field (see
+ * raytracing::field_t), in the same order and with the same types as the records of
+ * openPMD_io::Rays. Each column starts at a multiple of kAlignment bytes from the beginning of
+ * the file.
+ *
+ * The format is meant as a fast path for sources read many times on the same machine: the
+ * byte order is the native one, and openPMD stays the format for the data exchange. Files are
+ * converted without loss with openPMD_to_columnar() and columnar_to_openPMD().
+ *
+ * openPMD_io::init_read() recognizes the files in this format from their magic string, and
+ * returns the rays without copying them from the mapped memory.
+ */
+class columnar_file {
+public:
+	static constexpr std::uint64_t kAlignment = 4096; ///< alignment of the columns [bytes]
+	static constexpr std::uint32_t kVersion   = 1;    ///< version of the layout
+	static constexpr std::uint32_t kByteOrder = 0x01020304;
+
+	/** \struct header_t
+	 * \brief header at the beginning of the file
+	 *
+	 * min and max values are stored as the bit pattern of the type of the field
+	 */
+	struct header_t {
+		char magic[8];              ///< "RAYCOLS"
+		std::uint32_t version;      ///< kVersion
+		std::uint32_t byte_order;   ///< kByteOrder, written with the native byte order
+		std::uint32_t n_fields;     ///< kNFields
+		std::uint32_t iteration;    ///< openPMD iteration
+		std::uint64_t n_rays;       ///< number of rays
+		std::uint64_t offset[kNFields]; ///< position of the columns [bytes]
+		std::uint64_t min[kNFields];    ///< minimum value of each field
+		std::uint64_t max[kNFields];    ///< maximum value of each field
+		float gravity[3];               ///< direction of gravity
+		char particle_species[64];      ///< PDG ID, null terminated
+	};
+
+	/// \brief check if the file is in the native columnar format
+	static bool is_columnar(const std::string& filename);
+
+	/// \brief open and map an existing file for reading
+	explicit columnar_file(const std::string& filename);
+
+	/// \brief create a new file for n_rays rays and map it for writing
+	columnar_file(const std::string& filename, const std::string& particle_species,
+	              unsigned int iter, std::uint64_t n_rays);
+
+	~columnar_file();
+	columnar_file(const columnar_file&) = delete;
+	columnar_file& operator=(const columnar_file&) = delete;
+
+	const header_t& header(void) const { return *_header; }
+	std::string particle_species(void) const { return _header->particle_species; }
+
+	/// \brief pointer to the first value of the column
+	template <typename T> const T* column(field_t f) const {
+		return reinterpret_cast<const T*>(_data + _header->offset[f]);
+	}
+	/// \brief pointer to the first value of the column, only for files open for writing
+	template <typename T> T* column(field_t f) {
+		return reinterpret_cast<T*>(_data + _header->offset[f]);
+	}
+
+	template <typename T> T min(field_t f) const { return from_bits<T>(_header->min[f]); }
+	template <typename T> T max(field_t f) const { return from_bits<T>(_header->max[f]); }
+	/// \brief set the min-max values of a field, only for files open for writing
+	template <typename T> void set_range(field_t f, T min, T max) {
+		_header->min[f] = to_bits(min);
+		_header->max[f] = to_bits(max);
+	}
+
+	/// \brief set the direction of gravity, only for files open for writing
+	void set_gravity_direction(float x, float y, float z) {
+		_header->gravity[0] = x;
+		_header->gravity[1] = y;
+		_header->gravity[2] = z;
+	}
+
+private:
+	template <typename T> static std::uint64_t to_bits(T val) {
+		static_assert(sizeof(T) <= sizeof(std::uint64_t), "field type too large");
+		std::uint64_t bits = 0;
+		std::memcpy(&bits, &val, sizeof(T));
+		return bits;
+	}
+	template <typename T> static T from_bits(std::uint64_t bits) {
+		T val;
+		std::memcpy(&val, &bits, sizeof(T));
+		return val;
+	}
+
+	void map(size_t size, bool writable);
+
+	std::string _filename;
+	int _fd;
+	size_t _size;
+	unsigned char* _data;
+	header_t* _header;
+};
+
+/** \brief convert a particle species of an openPMD file into a native columnar file
+ */
+void openPMD_to_columnar(const std::string& pmd_filename,      ///< input openPMD file
+                         const std::string& particle_species,  ///< PDG ID of the particles
+                         unsigned int iter,                    ///< openPMD iteration
+                         const std::string& columnar_filename, ///< output file
+                         size_t chunk_size = 1 << 20           ///< number of rays read at once
+);
+
+/** \brief convert a native columnar file into an openPMD file following the ray trace extension
+ */
+void columnar_to_openPMD(const std::string& columnar_filename, ///< input file
+                         const std::string& pmd_filename);     ///< output openPMD file
+
+} // namespace raytracing
+#endif
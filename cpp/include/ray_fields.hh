@@ -0,0 +1,104 @@
+#ifndef RAY_FIELDS_HH
+#define RAY_FIELDS_HH
+///\file
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+namespace raytracing {
+
+/** \enum field_t
+ * \brief index of the ray properties
+ *
+ * There is one field per record component stored in the openPMD file, so one per column of
+ * rays held in memory by openPMD_io::Rays
+ */
+enum field_t : unsigned int {
+	kX = 0,
+	kY,
+	kZ, // position
+	kDX,
+	kDY,
+	kDZ, // direction
+	kSX,
+	kSY,
+	kSZ, // non-photon polarization
+	kSPolAx,
+	kSPolAy,
+	kSPolAz,
+	kSPolPh, // photon s-polarization
+	kPPolAx,
+	kPPolAy,
+	kPPolAz,
+	kPPolPh, // photon p-polarization
+	kWavelength,
+	kTime,
+	kWeight,
+	kId,
+	kStatus,
+	kNFields ///< number of fields
+};
+
+/** \struct field_info
+ * \brief names of the openPMD record and record component of a field
+ */
+struct field_info {
+	const char* record;    ///< openPMD record name
+	const char* component; ///< openPMD record component name, nullptr for scalar records
+	const char* name;      ///< short name, as the getter of the Ray class
+	size_t size;           ///< size in bytes of a value
+};
+
+/// \brief returns the openPMD names and the size of the field
+inline const field_info&
+get_field_info(field_t f) {
+	static const field_info fields[kNFields] = {
+	        {"position", "x", "x", sizeof(float)},
+	        {"position", "y", "y", sizeof(float)},
+	        {"position", "z", "z", sizeof(float)},
+	        {"direction", "x", "dx", sizeof(float)},
+	        {"direction", "y", "dy", sizeof(float)},
+	        {"direction", "z", "dz", sizeof(float)},
+	        {"nonPhotonPolarization", "x", "sx", sizeof(float)},
+	        {"nonPhotonPolarization", "y", "sy", sizeof(float)},
+	        {"nonPhotonPolarization", "z", "sz", sizeof(float)},
+	        {"photonSPolarizationAmplitude", "x", "sPolAx", sizeof(float)},
+	        {"photonSPolarizationAmplitude", "y", "sPolAy", sizeof(float)},
+	        {"photonSPolarizationAmplitude", "z", "sPolAz", sizeof(float)},
+	        {"photonSPolarizationPhase", nullptr, "sPolPh", sizeof(float)},
+	        {"photonPPolarizationAmplitude", "x", "pPolAx", sizeof(float)},
+	        {"photonPPolarizationAmplitude", "y", "pPolAy", sizeof(float)},
+	        {"photonPPolarizationAmplitude", "z", "pPolAz", sizeof(float)},
+	        {"photonPPolarizationPhase", nullptr, "pPolPh", sizeof(float)},
+	        {"wavelength", nullptr, "wavelength", sizeof(float)},
+	        {"rayTime", nullptr, "time", sizeof(float)},
+	        {"weight", nullptr, "weight", sizeof(float)},
+	        {"id", nullptr, "id", sizeof(unsigned long long int)},
+	        {"particleStatus", nullptr, "status", sizeof(int)},
+	};
+	return fields[f];
+}
+
+/// \brief set of fields, one bit per field
+typedef std::uint32_t field_mask_t;
+
+/// all the fields
+constexpr field_mask_t kAllFields = (field_mask_t(1) << kNFields) - 1;
+
+/// \brief mask with only the given field
+constexpr field_mask_t
+field_bit(field_t f) {
+	return field_mask_t(1) << f;
+}
+
+/// \brief mask with the given fields, e.g. field_mask({kX, kY, kWeight})
+inline field_mask_t
+field_mask(std::initializer_list<field_t> fields) {
+	field_mask_t mask = 0;
+	for (auto f : fields)
+		mask |= field_bit(f);
+	return mask;
+}
+
+} // namespace raytracing
+#endif
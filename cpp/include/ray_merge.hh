@@ -0,0 +1,37 @@
+#ifndef RAY_MERGE_HH
+#define RAY_MERGE_HH
+///\file
+#include <string>
+#include <vector>
+
+namespace raytracing {
+
+/** \struct merge_options
+ * \brief options of merge_files()
+ */
+struct merge_options {
+	bool renumber_id        = false;   ///< replace the ray ids by their index in the output
+	unsigned int n_threads  = 1;       ///< number of files read in parallel
+	size_t chunk_size       = 1 << 20; ///< number of rays copied at once
+};
+
+/** \brief concatenate the rays of a particle species from several files into one file
+ *
+ * The output datasets are declared once with the sum of the numParticles of the inputs. The
+ * inputs are written in the order of the list. The min-max attributes of the output cover all
+ * the rays, and the direction of gravity is the one of the first input.
+ *
+ * By default the files are read and written by the calling thread. With n_threads > 1, the
+ * inputs are read in parallel by n_threads threads, a few chunks ahead of the writer, if all
+ * the files use a backend that allows it (see io_threads()).
+ *
+ * \return the number of rays written
+ */
+unsigned long long int merge_files(const std::vector<std::string>& inputs, ///< input files
+                                   const std::string& output,           ///< output file
+                                   const std::string& particle_species, ///< PDG ID
+                                   unsigned int iter = 1,               ///< openPMD iteration
+                                   const merge_options& options = merge_options());
+
+} // namespace raytracing
+#endif
@@ -0,0 +1,117 @@
+#ifndef RAY_MULTI_READER_HH
+#define RAY_MULTI_READER_HH
+///\file
+#include "openPMD_io.hh"
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace raytracing {
+
+/** \struct read_request
+ * \brief iteration and particle species to be read by a multi_reader
+ */
+struct read_request {
+	unsigned int iter;                 ///< openPMD iteration
+	std::string particle_species;      ///< PDG ID
+	unsigned long long int n_rays = 0; ///< max number of rays to read, 0=ALL
+};
+
+/** \struct multi_reader_options
+ * \brief options of multi_reader
+ */
+struct multi_reader_options {
+	unsigned int n_threads = 1;       ///< number of threads reading the streams ahead
+	size_t chunk_size      = 1 << 20; ///< number of rays read at once
+	size_t depth           = 2;       ///< number of chunks read ahead for each stream
+};
+
+/** \class multi_reader
+ * \brief reads several iterations and particle species of a file at once
+ *
+ * Each requested iteration and particle species is a stream, with its own openPMD_io reader
+ * and buffers. The streams are independent readers: each can be consumed at its own pace,
+ * from any thread, with read_chunk() or trace_read().
+ *
+ * By default the chunks are read on demand by the thread consuming the stream, one stream at
+ * a time. With ADIOS2 or JSON files, and n_threads > 1, the streams are instead read ahead, a
+ * few chunks at a time, by a pool of threads, so that comparing the rays at N beamline
+ * components takes a single parallel pass instead of N sequential ones. The other files are
+ * always read on demand (see io_threads()).
+ */
+class multi_reader {
+public:
+	/** \class stream
+	 * \brief cursor on one iteration and particle species
+	 */
+	class stream {
+	public:
+		/** \brief next chunk of rays, waiting for it to be read if needed
+		 *
+		 * The chunk stays valid until the next call, and is empty when all the rays have
+		 * been read. The two reading methods should not be mixed.
+		 */
+		const openPMD_io::Rays& read_chunk(void);
+
+		/// \brief next ray of the stream
+		Ray trace_read(void);
+
+		/// \brief true if all the rays of the stream have been returned
+		bool is_read_finished(void);
+
+		unsigned long long int n_rays(void) const { return _n_rays; } ///< rays to be read
+		const read_request& request(void) const { return _request; }
+
+	private:
+		friend class multi_reader;
+		stream(multi_reader& owner, const read_request& request);
+
+		// waits for a chunk or the end of the stream, with the lock of the owner
+		bool wait_chunk(std::unique_lock<std::mutex>& lock);
+
+		multi_reader& _owner;
+		read_request _request;
+		std::unique_ptr<openPMD_io> _reader;
+		unsigned long long int _n_rays;
+
+		// shared with the reading threads, protected by the mutex of the owner
+		std::deque<openPMD_io::Rays> _queue;
+		bool _done = false;
+		std::exception_ptr _error;
+
+		openPMD_io::Rays _current; // chunk being consumed
+	};
+
+	/// \brief opens the requested streams and starts the reading threads, if any
+	multi_reader(const std::string& filename, const std::vector<read_request>& requests,
+	             const multi_reader_options& options = multi_reader_options());
+	/// \brief stops the reading threads
+	~multi_reader();
+
+	multi_reader(const multi_reader&) = delete;
+	multi_reader& operator=(const multi_reader&) = delete;
+
+	size_t size(void) const { return _streams.size(); } ///< number of streams
+	/// \brief stream in the order of the requests
+	stream& operator[](size_t i) { return *_streams[i]; }
+
+private:
+	// reads ahead the streams t, t+n_threads, ...
+	void work(unsigned int t);
+
+	std::string _name;
+	multi_reader_options _options;
+	std::vector<std::unique_ptr<stream>> _streams;
+	std::mutex _mutex;
+	std::condition_variable _data, _space; // a chunk was read, a chunk was consumed
+	bool _stop = false;
+	std::vector<std::thread> _threads;
+};
+
+} // namespace raytracing
+#endif
@@ -0,0 +1,339 @@
+#ifndef RAY_PIPELINE_HH
+#define RAY_PIPELINE_HH
+///\file
+#include "openPMD_io.hh"
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <thread>
+#include <vector>
+
+namespace raytracing {
+
+/** \struct ray_columns
+ * \brief columns of a chunk, as seen by the stages of a pipeline
+ *
+ * The stages access the property of the ray i as columns[kX][i], columns.id[i] or
+ * columns.status[i]. The columns of the records not loaded (see
+ * openPMD_io::set_projection()) are nullptr.
+ */
+struct ray_columns {
+	float* floats[kId];         ///< float columns, indexed by field_t
+	unsigned long long int* id; ///< id column
+	int* status;                ///< status column
+	size_t size;                ///< number of rays
+
+	float* operator[](field_t field) const { return floats[field]; }
+};
+
+/** \name Pipeline stages
+ *
+ * A stage is called for each ray of the chunk as stage(columns, i) and returns false to drop
+ * the ray. Stages are composed with operator|: the composition is a single stage, inlined by
+ * the compiler, so a whole pipeline is a single pass over the chunk. The stages after a
+ * filter only see the rays it keeps.
+ */
+///@{
+/// \brief keeps the rays for which pred(columns, i) is true
+template <typename P> struct filter_stage {
+	typedef void pipeline_stage;
+	P pred;
+	bool operator()(ray_columns& c, size_t i) {
+		return pred(static_cast<const ray_columns&>(c), i);
+	}
+	void finish(void) {}
+};
+
+/// \brief modifies the ray in place with f(columns, i)
+template <typename F> struct map_stage {
+	typedef void pipeline_stage;
+	F f;
+	bool operator()(ray_columns& c, size_t i) {
+		f(c, i);
+		return true;
+	}
+	void finish(void) {}
+};
+
+/** \brief accumulates f(partial, columns, i) over the rays
+ * The partial results of the threads are added to the result with +=, in a fixed order.
+ */
+template <typename T, typename F> struct reduce_stage {
+	typedef void pipeline_stage;
+	T* result;
+	F f;
+	T partial;
+	bool operator()(ray_columns& c, size_t i) {
+		f(partial, static_cast<const ray_columns&>(c), i);
+		return true;
+	}
+	void finish(void) {
+		*result += partial;
+		partial = T();
+	}
+};
+
+/// \brief composition of two stages
+template <typename A, typename B> struct fused_stage {
+	typedef void pipeline_stage;
+	A first;
+	B second;
+	bool operator()(ray_columns& c, size_t i) { return first(c, i) && second(c, i); }
+	void finish(void) {
+		first.finish();
+		second.finish();
+	}
+};
+
+template <typename P>
+filter_stage<P>
+filter(P pred) {
+	return {pred};
+}
+
+template <typename F>
+map_stage<F>
+map(F f) {
+	return {f};
+}
+
+/// \brief the result should stay valid as long as the pipeline is used
+template <typename T, typename F>
+reduce_stage<T, F>
+reduce(T& result, F f) {
+	return {&result, f, T()};
+}
+
+template <typename A, typename B, typename = typename A::pipeline_stage,
+          typename = typename B::pipeline_stage>
+fused_stage<A, B>
+operator|(A first, B second) {
+	return {first, second};
+}
+
+/// \brief keeps the rays with the given status
+inline auto
+cut_status(particleStatus_t status) {
+	return filter([status](const ray_columns& c, size_t i) { return c.status[i] == status; });
+}
+
+/// \brief keeps the rays with min <= field <= max
+inline auto
+cut_range(field_t field, float min, float max) {
+	return filter([field, min, max](const ray_columns& c, size_t i) {
+		return c[field][i] >= min && c[field][i] <= max;
+	});
+}
+
+/// \brief translates the positions [cm]
+inline auto
+shift(float x, float y, float z) {
+	return map([x, y, z](ray_columns& c, size_t i) {
+		c[kX][i] += x;
+		c[kY][i] += y;
+		c[kZ][i] += z;
+	});
+}
+
+/// \brief multiplies the weights by a factor
+inline auto
+scale_weight(float factor) {
+	return map([factor](ray_columns& c, size_t i) { c[kWeight][i] *= factor; });
+}
+///@}
+
+namespace detail {
+constexpr size_t kPipelineBlock = 1 << 14; ///< number of rays processed at once by a thread
+
+/// min-max values of the columns of the rays kept
+struct column_ranges {
+	float min[kId], max[kId];
+	unsigned long long int id_min, id_max;
+	int status_min, status_max;
+
+	column_ranges() {
+		std::fill(min, min + kId, std::numeric_limits<float>::max());
+		std::fill(max, max + kId, std::numeric_limits<float>::lowest());
+		id_min     = std::numeric_limits<unsigned long long int>::max();
+		id_max     = std::numeric_limits<unsigned long long int>::lowest();
+		status_min = std::numeric_limits<int>::max();
+		status_max = std::numeric_limits<int>::lowest();
+	}
+	void merge(const column_ranges& other) {
+		for (unsigned int f = 0; f < kId; ++f) {
+			min[f] = std::min(min[f], other.min[f]);
+			max[f] = std::max(max[f], other.max[f]);
+		}
+		id_min     = std::min(id_min, other.id_min);
+		id_max     = std::max(id_max, other.id_max);
+		status_min = std::min(status_min, other.status_min);
+		status_max = std::max(status_max, other.status_max);
+	}
+};
+
+inline void
+set_column(ray_columns& c, field_t field, openPMD_io::Rays::Record<float>& rec) {
+	c.floats[field] = rec.vals().empty() ? nullptr : rec.vals().data();
+}
+inline void
+set_column(ray_columns& c, field_t, openPMD_io::Rays::Record<unsigned long long int>& rec) {
+	c.id = rec.vals().empty() ? nullptr : rec.vals().data();
+}
+inline void
+set_column(ray_columns& c, field_t, openPMD_io::Rays::Record<int>& rec) {
+	c.status = rec.vals().empty() ? nullptr : rec.vals().data();
+}
+
+inline void
+set_range(openPMD_io::Rays::Record<float>& rec, field_t field, const column_ranges& r) {
+	rec.set_range(r.min[field], r.max[field]);
+}
+inline void
+set_range(openPMD_io::Rays::Record<unsigned long long int>& rec, field_t,
+          const column_ranges& r) {
+	rec.set_range(r.id_min, r.id_max);
+}
+inline void
+set_range(openPMD_io::Rays::Record<int>& rec, field_t, const column_ranges& r) {
+	rec.set_range(r.status_min, r.status_max);
+}
+
+/** runs the stages on the rays [begin, end) in a single pass: the rays kept are moved to the
+ * front of the range and their min-max values are accumulated
+ * \return the number of rays kept
+ */
+template <typename S>
+size_t
+run_block(S& stages, ray_columns& c, size_t begin, size_t end, column_ranges& r) {
+	size_t k = begin;
+	for (size_t i = begin; i < end; ++i) {
+		if (!stages(c, i)) continue;
+		for (unsigned int f = 0; f < kId; ++f) {
+			if (float* col = c.floats[f]) {
+				float v  = col[i];
+				col[k]   = v;
+				r.min[f] = std::min(r.min[f], v);
+				r.max[f] = std::max(r.max[f], v);
+			}
+		}
+		if (c.id != nullptr) {
+			c.id[k]  = c.id[i];
+			r.id_min = std::min(r.id_min, c.id[k]);
+			r.id_max = std::max(r.id_max, c.id[k]);
+		}
+		if (c.status != nullptr) {
+			c.status[k]  = c.status[i];
+			r.status_min = std::min(r.status_min, c.status[k]);
+			r.status_max = std::max(r.status_max, c.status[k]);
+		}
+		++k;
+	}
+	return k - begin;
+}
+
+/// moves n rays from the index from to the index to < from
+inline void
+move_rays(ray_columns& c, size_t from, size_t to, size_t n) {
+	for (unsigned int f = 0; f < kId; ++f)
+		if (c.floats[f] != nullptr)
+			std::memmove(c.floats[f] + to, c.floats[f] + from, n * sizeof(float));
+	if (c.id != nullptr) std::memmove(c.id + to, c.id + from, n * sizeof(*c.id));
+	if (c.status != nullptr)
+		std::memmove(c.status + to, c.status + from, n * sizeof(*c.status));
+}
+} // namespace detail
+
+/** \brief runs a pipeline on a chunk, in place
+ *
+ * The chunk is split in blocks processed by n_threads threads, each with its own copy of the
+ * stages: the map stages should not modify shared state, and the reductions are merged once
+ * the chunk is done. The min-max values of the records are those of the rays kept. A chunk
+ * that is a view on memory owned by someone else (shared cache, memory mapped file) is copied
+ * first.
+ */
+template <typename S>
+void
+run_pipeline(const S& stages, openPMD_io::Rays& chunk, unsigned int n_threads = 1) {
+	bool is_view = false;
+	chunk.for_each(
+	        [&](field_t, const auto& rec) { is_view |= rec.size() != rec.vals().size(); });
+	if (is_view) {
+		openPMD_io::Rays owned;
+		owned.copy(chunk);
+		chunk = std::move(owned);
+	}
+
+	ray_columns columns;
+	columns.size = chunk.size();
+	chunk.for_each([&](field_t field, auto& rec) { detail::set_column(columns, field, rec); });
+
+	size_t n_blocks = (columns.size + detail::kPipelineBlock - 1) / detail::kPipelineBlock;
+	n_threads       = std::max<unsigned int>(1, std::min<size_t>(n_threads, n_blocks));
+	std::vector<size_t> kept(n_blocks);
+	std::vector<S> copies(n_threads, stages);
+	std::vector<detail::column_ranges> ranges(n_threads);
+	std::vector<std::exception_ptr> errors(n_threads);
+	auto work = [&](unsigned int t) {
+		try {
+			for (size_t b = t; b < n_blocks; b += n_threads) {
+				size_t begin = b * detail::kPipelineBlock;
+				size_t end = std::min(begin + detail::kPipelineBlock, columns.size);
+				kept[b] = detail::run_block(copies[t], columns, begin, end, ranges[t]);
+			}
+		} catch (...) {
+			errors[t] = std::current_exception();
+		}
+	};
+	if (n_threads == 1)
+		work(0);
+	else {
+		std::vector<std::thread> threads;
+		for (unsigned int t = 0; t < n_threads; ++t)
+			threads.emplace_back(work, t);
+		for (auto& t : threads)
+			t.join();
+	}
+	for (auto& e : errors)
+		if (e) std::rethrow_exception(e);
+
+	// the rays kept in each block follow those of the previous blocks
+	size_t size = 0;
+	for (size_t b = 0; b < n_blocks; ++b) {
+		if (size != b * detail::kPipelineBlock)
+			detail::move_rays(columns, b * detail::kPipelineBlock, size, kept[b]);
+		size += kept[b];
+	}
+	for (unsigned int t = 0; t < n_threads; ++t) {
+		copies[t].finish();
+		if (t != 0) ranges[0].merge(ranges[t]);
+	}
+	chunk.for_each([&](field_t field, auto& rec) {
+		if (rec.vals().empty()) return;
+		rec.vals().resize(size);
+		detail::set_range(rec, field, ranges[0]);
+	});
+	chunk.size(size);
+}
+
+/** \brief a pipeline as a transformation of the chunks of openPMD_io
+ *
+ * \code
+ * double intensity = 0;
+ * io.set_read_pipeline(make_pipeline(
+ *         cut_status(kAlive) | cut_range(kWavelength, 1.f, 5.f) | shift(0, 0, -100) |
+ *         reduce(intensity,
+ *                [](double& w, const ray_columns& c, size_t i) { w += c[kWeight][i]; }),
+ *         4));
+ * \endcode
+ */
+template <typename S>
+openPMD_io::transform_t
+make_pipeline(S stages, unsigned int n_threads = 1) {
+	return [stages, n_threads](openPMD_io::Rays& chunk) {
+		run_pipeline(stages, chunk, n_threads);
+	};
+}
+
+} // namespace raytracing
+#endif
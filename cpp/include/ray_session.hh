@@ -0,0 +1,82 @@
+#ifndef RAY_SESSION_HH
+#define RAY_SESSION_HH
+///\file
+#include "openPMD_io.hh"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace raytracing {
+
+/** \class ray_session
+ * \brief one file shared by the writers of all the components of a beamline
+ *
+ * Instead of one file per monitor, the session opens a single openPMD::Series and hands out a
+ * writer per component. Each component is written in its own iteration, numbered in the order
+ * the components are added, with the name in the componentName attribute of the iteration.
+ * The writers are used as any openPMD_io in write mode (trace_write(), write_chunk(),
+ * init_rays() for more particle species...), except for init_write() and init_read().
+ *
+ * When the buffer of one writer is full, the pending rays of all the writers are written
+ * with a single flush of the series. The file is closed, with the summary attributes and the
+ * rayIndex of all the components, by close() or by the destructor.
+ *
+ * Streaming is not available. It is not thread safe: all the writers should be used from the
+ * same thread.
+ */
+class ray_session {
+public:
+	explicit ray_session(const std::string& filename, ///< file of all the components
+	                     const std::string& mc_code_name = "", ///< [optional] simulation code
+	                     const std::string& instrument_name = "" ///< [optional] instrument
+	);
+	~ray_session();
+
+	ray_session(const ray_session&) = delete;
+	ray_session& operator=(const ray_session&) = delete;
+
+	/// \brief number of rays written at once by each writer, for the components added next
+	void set_chunk_size(size_t chunk_size) { _chunk_size = chunk_size; }
+
+	/// \brief options of the series, to be set before the first component is added
+	void set_backend_config(const backend_config& config);
+
+	/** \brief adds a component and returns its writer
+	 *
+	 * The writer is owned by the session and stays valid until close(). The particle
+	 * species is declared for n_rays rays, as with openPMD_io::init_write().
+	 */
+	openPMD_io& add_component(const std::string& name,             ///< component name
+	                          const std::string& particle_species, ///< PDG ID
+	                          unsigned long long int n_rays        ///< number of rays (max)
+	);
+
+	/// \brief writer of a component already added
+	openPMD_io& component(const std::string& name);
+
+	/// \brief iteration of the file where the rays of the component are written
+	unsigned int iteration(const std::string& name) const;
+
+	/// \brief writes the pending rays of all the components at once
+	void flush(void);
+
+	/// \brief writes the pending rays and the summary attributes, and closes the file
+	void close(void);
+
+private:
+	friend class openPMD_io;
+	// adds the entries of the rayIndex of a writer
+	void add_index(const std::vector<std::string>& index);
+
+	std::string _filename, _mc_code_name, _instrument_name;
+	size_t _chunk_size;
+	backend_config _backend;
+	std::shared_ptr<openPMD::Series> _series;
+	std::vector<std::unique_ptr<openPMD_io>> _writers; // in the order of the iterations
+	std::map<std::string, unsigned int> _iterations;   // iteration of each component
+	std::vector<std::string> _index;                   // rayIndex of the closed writers
+};
+
+} // namespace raytracing
+#endif
@@ -0,0 +1,63 @@
+#ifndef RAY_SHARD_HH
+#define RAY_SHARD_HH
+///\file
+#include <string>
+#include <vector>
+
+namespace raytracing {
+
+/** \enum shard_balance_t
+ * \brief quantity balanced between the shards by split_file()
+ */
+enum shard_balance_t : int {
+	kBalanceCount = 0, ///< same number of rays in each shard
+	kBalanceWeight     ///< same total weight in each shard
+};
+
+/** \struct shard_options
+ * \brief options of split_file()
+ */
+struct shard_options {
+	shard_balance_t balance = kBalanceCount; ///< quantity balanced between the shards
+	unsigned int n_threads  = 1;             ///< number of shards written in parallel
+	size_t chunk_size       = 1 << 20;       ///< number of rays copied at once
+};
+
+/** \struct shard_info
+ * \brief description of a shard written by split_file()
+ */
+struct shard_info {
+	std::string filename;         ///< name of the shard file
+	unsigned long long int first; ///< index in the source file of the first ray
+	unsigned long long int last;  ///< index in the source file after the last ray
+	double weight;                ///< total weight of the rays of the shard
+};
+
+/** \brief name of the file of a shard: the index is added before the extension
+ *
+ * e.g. "source.h5" gives "source_0.h5", "source_1.h5", ...
+ */
+std::string shard_filename(const std::string& output, unsigned int shard);
+
+/** \brief split the rays of a particle species of a file in n_shards consecutive ranges
+ *
+ * Each shard is written in its own file (see shard_filename()), with the provenance
+ * attributes shardSource, shardIndex, shardCount, shardFirstRay and shardLastRay on the
+ * particle species. Balancing by weight requires one more pass over the source file. Each
+ * shard is copied chunk by chunk.
+ *
+ * By default the shards are written one after the other by the calling thread. With
+ * n_threads > 1, they are written in parallel if the source and the shards use a backend that
+ * allows it (see io_threads()).
+ *
+ * \return the description of the shards
+ */
+std::vector<shard_info> split_file(const std::string& input,            ///< source file
+                                   const std::string& output,           ///< shard file pattern
+                                   const std::string& particle_species, ///< PDG ID
+                                   unsigned int n_shards,               ///< number of shards
+                                   unsigned int iter = 1,               ///< openPMD iteration
+                                   const shard_options& options = shard_options());
+
+} // namespace raytracing
+#endif
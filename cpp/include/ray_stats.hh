@@ -0,0 +1,87 @@
+#ifndef RAY_STATS_HH
+#define RAY_STATS_HH
+///\file
+#include "openPMD_io.hh"
+#include "ray_fields.hh"
+#include <string>
+
+namespace raytracing {
+
+/** \class beam_stats
+ * \brief weighted moments of the rays: intensity, mean, covariance and emittance
+ *
+ * The moments are computed for the position, the direction, the wavelength and the time. For
+ * a beam along z, the x and y components of the direction are the divergence angles in the
+ * small-angle approximation.
+ *
+ * Each chunk is reduced around its own mean, and the partial results are combined with the
+ * pairwise update of Chan et al. (a weighted Welford update per chunk), so that the moments
+ * are stable also when the spread is small compared to the mean. The total weight is summed
+ * with Kahan compensation.
+ */
+class beam_stats {
+public:
+	/// number of fields with statistics
+	static constexpr unsigned int kNStatFields = 8;
+
+	beam_stats();
+
+	/// \brief accumulates the rays of a chunk
+	void add(const openPMD_io::Rays& rays);
+
+	/// \brief combines the statistics of another set of rays
+	void merge(const beam_stats& other);
+
+	unsigned long long int n_rays(void) const { return _n; } ///< number of rays
+	double intensity(void) const { return _weight; }          ///< sum of the weights
+
+	/// \name Moments, the field should be a position, a direction, kWavelength or kTime
+	///@{
+	double mean(field_t f) const;                  ///< weighted mean
+	double covariance(field_t f, field_t g) const; ///< weighted (population) covariance
+	double rms(field_t f) const;                   ///< weighted standard deviation
+	///@}
+
+	/** \brief RMS emittance in the plane of a transverse coordinate (kX or kY)
+	 *
+	 * sqrt(<x^2><x'^2> - <xx'>^2) with the centered moments of the position and of the
+	 * direction along the same axis
+	 */
+	double emittance(field_t f) const;
+
+	/// \brief fields with statistics, in the order of the internal index
+	static field_t stat_field(unsigned int i);
+
+private:
+	unsigned long long int _n;
+	double _weight, _weight_c;         // sum of the weights and its Kahan compensation
+	double _mean[kNStatFields];        // weighted means
+	double _comoment[kNStatFields][kNStatFields]; // sums of w (a-<a>)(b-<b>)
+
+	// combines a partial result with n rays, weight w, means and comoments
+	void merge(unsigned long long int n, double w, const double* mean,
+	           const double (*comoment)[kNStatFields]);
+};
+
+/** \struct stats_options
+ * \brief options of compute_stats()
+ */
+struct stats_options {
+	unsigned int n_threads = 1;       ///< number of ranges of rays reduced in parallel
+	size_t chunk_size      = 1 << 20; ///< number of rays read at once
+};
+
+/** \brief weighted moments of the rays of a particle species of a file, in one pass
+ *
+ * By default the rays are read chunk by chunk by the calling thread. With n_threads > 1 and a
+ * backend that allows it (see io_threads()), they are split in n_threads consecutive ranges,
+ * each read by its own thread, and the partial statistics are merged in order, so the result
+ * does not depend on the scheduling.
+ */
+beam_stats compute_stats(const std::string& input,            ///< ray file
+                         const std::string& particle_species, ///< PDG ID
+                         unsigned int iter = 1,               ///< openPMD iteration
+                         const stats_options& options = stats_options());
+
+} // namespace raytracing
+#endif
@@ -0,0 +1,222 @@
+#ifndef RAY_UNITS_HH
+#define RAY_UNITS_HH
+///\file
+#include "openPMD_io.hh"
+#include "ray.hh"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+namespace raytracing {
+
+/** \namespace raytracing::units
+ * \brief compile-time unit policies for the batch conversions
+ *
+ * Each policy gives the value of the unit in SI, so that the conversion factors are constant
+ * expressions folded into the conversion loops.
+ */
+namespace units {
+struct m {
+	static constexpr double si = 1.;
+};
+struct cm {
+	static constexpr double si = 1e-2;
+};
+struct mm {
+	static constexpr double si = 1e-3;
+};
+struct angstrom {
+	static constexpr double si = 1e-10;
+};
+struct s {
+	static constexpr double si = 1.;
+};
+struct ms {
+	static constexpr double si = 1e-3;
+};
+struct us {
+	static constexpr double si = 1e-6;
+};
+
+/// \brief factor converting a value in the unit From into the unit To
+template <class From, class To> constexpr double factor() { return From::si / To::si; }
+
+using file_length     = cm; ///< unit of the positions stored in the openPMD file
+using file_time       = ms; ///< unit of the ray time stored in the openPMD file
+using file_wavelength = m;  ///< unit of the wavelength stored in the openPMD file
+} // namespace units
+
+/** \name Batch conversion kernels
+ * The kernels work on column buffers of n values, in simple loops without branches that the
+ * compiler vectorizes (the square roots need -fno-math-errno with GCC).
+ */
+///@{
+
+/// \brief converts n values from the unit From into the unit To
+template <class From, class To, typename TIn, typename TOut>
+void
+convert_units(const TIn* in, TOut* out, size_t n) {
+	constexpr double f = units::factor<From, To>();
+	for (size_t i = 0; i < n; ++i)
+		out[i] = in[i] * f;
+}
+
+/// \brief neutron velocities [m/s] to unit directions and wavelengths in the unit W
+template <class W = units::file_wavelength, typename TIn, typename TOut>
+void
+velocity_to_direction(const TIn* vx, const TIn* vy, const TIn* vz, size_t n, TOut* dx, TOut* dy,
+                      TOut* dz, TOut* wavelength) {
+	constexpr double f = V2W * units::factor<units::m, W>();
+	for (size_t i = 0; i < n; ++i) {
+		double inv_v  = 1. / std::sqrt(double(vx[i]) * vx[i] + double(vy[i]) * vy[i] +
+                                              double(vz[i]) * vz[i]);
+		dx[i]         = vx[i] * inv_v;
+		dy[i]         = vy[i] * inv_v;
+		dz[i]         = vz[i] * inv_v;
+		wavelength[i] = f * inv_v;
+	}
+}
+
+/// \brief unit directions and wavelengths in the unit W to neutron velocities [m/s]
+template <class W = units::file_wavelength, typename TIn, typename TOut>
+void
+direction_to_velocity(const TIn* dx, const TIn* dy, const TIn* dz, const TIn* wavelength,
+                      size_t n, TOut* vx, TOut* vy, TOut* vz) {
+	constexpr double f = V2W * units::factor<units::m, W>();
+	for (size_t i = 0; i < n; ++i) {
+		double v = f / wavelength[i];
+		vx[i]    = dx[i] * v;
+		vy[i]    = dy[i] * v;
+		vz[i]    = dz[i] * v;
+	}
+}
+
+/// \brief neutron energies [meV] to wavelengths in the unit W
+template <class W = units::file_wavelength, typename TIn, typename TOut>
+void
+energy_to_wavelength(const TIn* energy, size_t n, TOut* wavelength) {
+	// E = kVS2E v^2 and lambda = V2W / v
+	constexpr double f = V2W * units::factor<units::m, W>();
+	for (size_t i = 0; i < n; ++i)
+		wavelength[i] = f * std::sqrt(kVS2E / energy[i]);
+}
+
+/// \brief wavelengths in the unit W to neutron energies [meV]
+template <class W = units::file_wavelength, typename TIn, typename TOut>
+void
+wavelength_to_energy(const TIn* wavelength, size_t n, TOut* energy) {
+	constexpr double f = V2W * units::factor<units::m, W>();
+	for (size_t i = 0; i < n; ++i) {
+		double v  = f / wavelength[i];
+		energy[i] = kVS2E * v * v;
+	}
+}
+///@}
+
+namespace detail {
+/// extends the min-max values of a record to the values appended from the index begin
+template <typename T>
+void
+update_range(openPMD_io::Rays::Record<T>& record, size_t begin) {
+	auto& vals = record.vals();
+	if (begin == vals.size()) return;
+	auto range = std::minmax_element(vals.begin() + begin, vals.end());
+	record.update_range(*range.first, *range.second);
+}
+
+/// appends n values computed by kernel(out) to a record
+template <typename T, typename K>
+void
+append_column(openPMD_io::Rays::Record<T>& record, size_t n, K&& kernel) {
+	size_t begin = record.vals().size();
+	record.vals().resize(begin + n);
+	kernel(record.vals().data() + begin);
+	update_range(record, begin);
+}
+
+/// appends n copies of a value to a record
+template <typename T>
+void
+append_constant(openPMD_io::Rays::Record<T>& record, size_t n, T value) {
+	append_column(record, n, [&](T* out) { std::fill(out, out + n, value); });
+}
+} // namespace detail
+
+/** \brief appends n McStas neutrons to a chunk, converting the units in the copy
+ *
+ * The positions are in the unit L and the times in the unit T (McStas uses m and s), the
+ * velocities in m/s. The spin is optional. The chunk can then be written with
+ * openPMD_io::write_chunk(), without going through Ray objects.
+ */
+template <class L = units::m, class T = units::s>
+void
+push_mcstas_neutrons(openPMD_io::Rays& rays, size_t n, const double* x, const double* y,
+                     const double* z, const double* vx, const double* vy, const double* vz,
+                     const double* t, const double* p, const double* sx = nullptr,
+                     const double* sy = nullptr, const double* sz = nullptr) {
+	using detail::append_column;
+	using detail::append_constant;
+	using L_file = units::file_length;
+	append_column(rays._x, n, [&](float* out) { convert_units<L, L_file>(x, out, n); });
+	append_column(rays._y, n, [&](float* out) { convert_units<L, L_file>(y, out, n); });
+	append_column(rays._z, n, [&](float* out) { convert_units<L, L_file>(z, out, n); });
+
+	// the four columns are computed in one pass
+	openPMD_io::Rays::Record<float>* dir[4] = {&rays._dx, &rays._dy, &rays._dz,
+	                                           &rays._wavelength};
+	size_t begin                            = rays._dx.vals().size();
+	for (auto* r : dir)
+		r->vals().resize(begin + n);
+	velocity_to_direction(vx, vy, vz, n, rays._dx.vals().data() + begin,
+	                      rays._dy.vals().data() + begin, rays._dz.vals().data() + begin,
+	                      rays._wavelength.vals().data() + begin);
+	for (auto* r : dir)
+		detail::update_range(*r, begin);
+
+	const double* spin[3]                     = {sx, sy, sz};
+	openPMD_io::Rays::Record<float>* s_rec[3] = {&rays._sx, &rays._sy, &rays._sz};
+	for (int d = 0; d < 3; ++d) {
+		if (spin[d] != nullptr)
+			append_column(*s_rec[d], n,
+			              [&](float* out) { std::copy(spin[d], spin[d] + n, out); });
+		else
+			append_constant(*s_rec[d], n, 0.f);
+	}
+	for (auto* r : {&rays._sPolAx, &rays._sPolAy, &rays._sPolAz, &rays._sPolPh, &rays._pPolAx,
+	                &rays._pPolAy, &rays._pPolAz, &rays._pPolPh})
+		append_constant(*r, n, 0.f);
+
+	append_column(rays._time, n,
+	              [&](float* out) { convert_units<T, units::file_time>(t, out, n); });
+	append_column(rays._weight, n, [&](float* out) { std::copy(p, p + n, out); });
+	append_constant(rays._id, n, 0ull);
+	append_constant(rays._status, n, particleStatus_t(kAlive));
+	rays.size(rays._x.size());
+}
+
+/** \brief copies n rays of a chunk from the index first into McStas neutron columns,
+ * converting the units in the copy
+ *
+ * The units are the ones of push_mcstas_neutrons(). The spin is optional.
+ */
+template <class L = units::m, class T = units::s>
+void
+pop_mcstas_neutrons(const openPMD_io::Rays& rays, size_t first, size_t n, double* x, double* y,
+                    double* z, double* vx, double* vy, double* vz, double* t, double* p,
+                    double* sx = nullptr, double* sy = nullptr, double* sz = nullptr) {
+	using L_file = units::file_length;
+	convert_units<L_file, L>(rays._x.data() + first, x, n);
+	convert_units<L_file, L>(rays._y.data() + first, y, n);
+	convert_units<L_file, L>(rays._z.data() + first, z, n);
+	direction_to_velocity(rays._dx.data() + first, rays._dy.data() + first,
+	                      rays._dz.data() + first, rays._wavelength.data() + first, n, vx, vy,
+	                      vz);
+	convert_units<units::file_time, T>(rays._time.data() + first, t, n);
+	std::copy(rays._weight.data() + first, rays._weight.data() + first + n, p);
+	if (sx != nullptr) std::copy(rays._sx.data() + first, rays._sx.data() + first + n, sx);
+	if (sy != nullptr) std::copy(rays._sy.data() + first, rays._sy.data() + first + n, sy);
+	if (sz != nullptr) std::copy(rays._sz.data() + first, rays._sz.data() + first + n, sz);
+}
+
+} // namespace raytracing
+#endif
@@ -1,5 +1,18 @@
 #include "openPMD_io.hh"
+#include "ray_columnar.hh"
+#include "ray_sampling.hh"
+#include "ray_session.hh"
+#include "ray_sort.hh"
+#include "shm_cache.hh"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
+#include <type_traits>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <thread>
 #include <openPMD/openPMD.hpp> // openPMD C++ API
 
 #ifdef DEBUG
@@ -19,15 +32,48 @@
 ///\file
 // using namespace raytracing;
 // using raytracing::openPMD_io;
-/** \brief defines the maximum number of rays that can be stored in memory before dumping to file
- * \todo The CHUNK_SIZE should not be hardcoded
- * it should also be optimized with tests
+/** \brief defines the default maximum number of rays that can be stored in memory before
+ * dumping to file, see openPMD_io::set_chunk_size()
+ * \todo it should be optimized with tests
  */
 namespace raytracing {
 // constexpr size_t CHUNK_SIZE = 10000;
 constexpr size_t CHUNK_SIZE = 3;
+/// maximum distance between two rays read with the same loadChunk in sampled mode
+constexpr std::uint64_t kSampleGap = 64;
+/// maximum number of entries of the alias table, beyond which it is built on blocks of rays
+constexpr std::uint64_t kMaxAliasEntries = 1 << 22;
+/// number of weights loaded at once when building the alias table
+constexpr std::uint64_t kWeightPass = 1 << 20;
 } // namespace raytracing
 
+namespace {
+/// absolute path of the file without symbolic links, the filename if it cannot be resolved
+std::string
+canonical_path(const std::string& filename) {
+#if defined(__unix__) || defined(__APPLE__)
+	// the path is allocated by realpath(), there is no PATH_MAX on every system
+	std::unique_ptr<char, void (*)(void*)> path(realpath(filename.c_str(), nullptr), std::free);
+	if (path) return path.get();
+#endif
+	return filename;
+}
+
+/** writes the values in a record component of their own size: attributes are limited in size
+ * (64 KiB in HDF5), and tables with one entry per chunk can grow beyond that. The values are
+ * copied, since they are written at the next flush.
+ */
+template <typename T>
+void
+store_table(openPMD::RecordComponent& rc, const std::vector<T>& values) {
+	openPMD::Extent extent = {values.size()};
+	rc.resetDataset(openPMD::Dataset(openPMD::determineDatatype<T>(), extent));
+	std::shared_ptr<T> data(new T[values.size()], std::default_delete<T[]>());
+	std::copy(values.begin(), values.end(), data.get());
+	rc.storeChunk(data, openPMD::Offset{0}, extent);
+}
+} // namespace
+
 /** \todo use particlePatches ... but I don't understand if/how */
 
 //------------------------------------------------------------
@@ -44,16 +90,112 @@ raytracing::openPMD_io::openPMD_io(const std::string& filename, std::string mc_c
     _name_current_component(name_current_component),
     _i_repeat(0),
     _n_repeat(1),
+    _chunk_size(CHUNK_SIZE),
     _offset({0}),
-    _series(nullptr){};
+    _series(nullptr),
+    _sort_key(kSortNone),
+    _projection(kAllFields),
+    _read_fields(kAllFields),
+    _session(nullptr),
+    _write_current(nullptr),
+    _isStreaming(false),
+    _nsteps(0),
+    _stream_step(nullptr),
+    _gravity{0, 0, 0},
+    _isSharedCache(false),
+    _isSharedCachePersistent(false),
+    _sampling(kSequential),
+    _sampling_seed(0),
+    _sample_factor(1.),
+    _replay_budget(0),
+    _replay_cycle(false),
+    _isReplaying(false),
+    _isFollowing(false),
+    _follow_timeout(60.),
+    _follow_poll(1.),
+    _follow_limit(0) {};
+
+raytracing::openPMD_io::~openPMD_io() {
+	try {
+		close_write();
+	} catch (std::exception& e) {
+		std::cerr << "[ERROR] Cannot write the summary attributes: " << e.what() << std::endl;
+	}
+}
+
+//------------------------------------------------------------
+raytracing::openPMD_io::species_plan::species_plan(openPMD::ParticleSpecies& rays):
+    species(rays) {
+	components.reserve(kNFields);
+	for (unsigned int f = 0; f < kNFields; ++f)
+		components.push_back(record_pmd(species, field_t(f)));
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::set_chunk_size(size_t chunk_size) {
+	if (chunk_size == 0) throw std::runtime_error("The chunk size must be at least one ray");
+	_chunk_size = chunk_size;
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::set_streaming(bool streaming, std::string engine) {
+	_isStreaming   = streaming;
+	_stream_engine = engine;
+}
+
+//------------------------------------------------------------
+std::string
+raytracing::openPMD_io::series_options(bool isWriteMode) const {
+	if (!_backend.series_json.empty()) return _backend.series_json;
+
+	std::string engine = (_isStreaming && !_stream_engine.empty()) ? _stream_engine
+	                                                               : _backend.adios2_engine;
+	std::vector<std::string> parameters;
+	// a BP4 file can be read while it is being written only in StreamReader mode
+	if (_isStreaming && engine == "bp4" && !isWriteMode) {
+		parameters.push_back(R"("StreamReader": "On")");
+		parameters.push_back(R"("OpenTimeoutSecs": "3600")");
+	}
+	if (isWriteMode && _backend.adios2_aggregators != 0)
+		parameters.push_back(R"("NumAggregators": ")" +
+		                     std::to_string(_backend.adios2_aggregators) + "\"");
+	if (isWriteMode && !_backend.adios2_buffer_size.empty())
+		parameters.push_back(R"("InitialBufferSize": ")" + _backend.adios2_buffer_size + "\"");
+	// the iterations are parsed when opened, only the requested one is read
+	bool defer = !isWriteMode && !_isStreaming;
+	if (engine.empty() && parameters.empty())
+		return defer ? R"({"defer_iteration_parsing": true})" : "{}";
+
+	std::string options = defer ? R"({"defer_iteration_parsing": true, )" : "{";
+	options += R"("adios2": {"engine": {)";
+	if (!engine.empty()) options += R"("type": ")" + engine + "\"";
+	if (!parameters.empty()) {
+		options += engine.empty() ? R"("parameters": {)" : R"(, "parameters": {)";
+		for (size_t i = 0; i < parameters.size(); ++i)
+			options += (i == 0 ? "" : ", ") + parameters[i];
+		options += "}";
+	}
+	return options + "}}}";
+}
+
+//------------------------------------------------------------
+std::string
+raytracing::openPMD_io::dataset_options(unsigned long long int n_rays) const {
+	if (!_backend.dataset_json.empty()) return _backend.dataset_json;
+	if (_backend.hdf5_chunk == 0) return "{}";
+	// the chunks cannot be larger than the dataset
+	return R"({"hdf5": {"dataset": {"chunks": [)" +
+	       std::to_string(std::min(_backend.hdf5_chunk, std::max(n_rays, 1ull))) + "]}}}";
+}
 
 //------------------------------------------------------------
 void
-raytracing::openPMD_io::init_ray_prop(std::string name, openPMD::Dataset& dataset, bool isScalar,
+raytracing::openPMD_io::init_ray_prop(openPMD::ParticleSpecies& rays, std::string name,
+                                      openPMD::Dataset& dataset, bool isScalar,
                                       std::map<openPMD::UnitDimension, double> const& dims,
                                       double unitSI) {
-	auto rays = rays_pmd();
-
 	rays[name].setUnitDimension(dims);
 
 	if (isScalar) {
@@ -79,59 +221,96 @@ raytracing::openPMD_io::init_ray_prop(std::string name, openPMD::Dataset& datase
 void
 raytracing::openPMD_io::init_rays(std::string particle_species, unsigned long long int n_rays,
                                   unsigned int iter) {
-	_max_allowed_rays = n_rays;
-	_nrays            = 0;
-
 	DEBUG_START("INIT_RAYS")
 
-	auto rays = rays_pmd(particle_species);
+	// each particle species has its own buffer and counters
+	species_buffer& sp = _write_species[particle_species];
+	sp.rays.clear();
+	sp.staged.clear();
+	// the buffers of a whole chunk, from the buffer pool: no reallocation while filling
+	(_write_pipeline ? sp.staged : sp.rays)
+	        .reserve(std::min<unsigned long long int>(_chunk_size, n_rays));
+	sp.population       = population_control();
+	sp.sort_offsets.clear();
+	sp.sort_min.clear();
+	sp.sort_max.clear();
+	sp.offset           = {0};
+	sp.nrays            = 0;
+	sp.max_rays         = n_rays;
+	_particle_species   = particle_species;
+	_write_current      = &sp;
+	_write_current_name = particle_species;
+
+	// in streaming mode the datasets are declared at each step with the size of the chunk
+	if (!_isStreaming) {
+		auto& rays = species_pmd(particle_species);
+		declare_rays(rays, particle_species, n_rays);
+		sp.plan.reset(new species_plan(rays));
+	}
 
+	DEBUG_END("INIT_RAYS")
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::declare_rays(openPMD::ParticleSpecies& rays, std::string particle_species,
+                                     unsigned long long int n_rays) {
 	// these are a single entry to mark some general properties of the particles
 	openPMD::Dataset dataset_single_float =
 	        openPMD::Dataset(openPMD::Datatype::FLOAT, openPMD::Extent{1});
-	init_ray_prop("directionOfGravity", dataset_single_float, false);
-	init_ray_prop("horizontalCoordinate", dataset_single_float, false);
-	init_ray_prop("mass", dataset_single_float, true, {{openPMD::UnitDimension::M, 1.}});
+	init_ray_prop(rays, "directionOfGravity", dataset_single_float, false);
+	init_ray_prop(rays, "horizontalCoordinate", dataset_single_float, false);
+	init_ray_prop(rays, "mass", dataset_single_float, true, {{openPMD::UnitDimension::M, 1.}});
 
 	rays.setAttribute("speciesType", particle_species);
 	rays.setAttribute("PDGID", particle_species);
 	rays.setAttribute("numParticles", 0);
 
+	std::string options = dataset_options(n_rays);
 	openPMD::Dataset dataset_float =
-	        openPMD::Dataset(openPMD::Datatype::FLOAT, openPMD::Extent{n_rays});
+	        openPMD::Dataset(openPMD::Datatype::FLOAT, openPMD::Extent{n_rays}, options);
 	openPMD::Dataset dataset_int =
-	        openPMD::Dataset(openPMD::Datatype::INT, openPMD::Extent{n_rays});
+	        openPMD::Dataset(openPMD::Datatype::INT, openPMD::Extent{n_rays}, options);
 	openPMD::Dataset dataset_ulongint =
-	        openPMD::Dataset(openPMD::Datatype::ULONGLONG, openPMD::Extent{n_rays});
+	        openPMD::Dataset(openPMD::Datatype::ULONGLONG, openPMD::Extent{n_rays}, options);
 
-	init_ray_prop("position", dataset_float, false, {{openPMD::UnitDimension::L, 1.}}, 1e-2); //cm
-	init_ray_prop("direction", dataset_float, false);
+	init_ray_prop(rays, "position", dataset_float, false, {{openPMD::UnitDimension::L, 1.}},
+	              1e-2); // cm
+	init_ray_prop(rays, "direction", dataset_float, false);
 
-	init_ray_prop("nonPhotonPolarization", dataset_float, false);
-	init_ray_prop("photonSPolarizationAmplitude", dataset_float, false);
-	init_ray_prop("photonSPolarizationPhase", dataset_float, true);
-	init_ray_prop("photonPPolarizationAmplitude", dataset_float, false);
-	init_ray_prop("photonPPolarizationPhase", dataset_float, true);
+	init_ray_prop(rays, "nonPhotonPolarization", dataset_float, false);
+	init_ray_prop(rays, "photonSPolarizationAmplitude", dataset_float, false);
+	init_ray_prop(rays, "photonSPolarizationPhase", dataset_float, true);
+	init_ray_prop(rays, "photonPPolarizationAmplitude", dataset_float, false);
+	init_ray_prop(rays, "photonPPolarizationPhase", dataset_float, true);
 
-	init_ray_prop("wavelength", dataset_float, true, {{openPMD::UnitDimension::L, 1}},
+	init_ray_prop(rays, "wavelength", dataset_float, true, {{openPMD::UnitDimension::L, 1}},
 	              1); // 1.6021766e-13); // MeV ///\todo which units?
-	init_ray_prop("weight", dataset_float, true);
-	init_ray_prop("rayTime", dataset_float, true, {{openPMD::UnitDimension::T, 1.}}, 1e-3); //ms
+	init_ray_prop(rays, "weight", dataset_float, true);
+	init_ray_prop(rays, "rayTime", dataset_float, true, {{openPMD::UnitDimension::T, 1.}},
+	              1e-3); // ms
 
-	init_ray_prop("id", dataset_ulongint, true);
-	init_ray_prop("particleStatus", dataset_int, true);
+	init_ray_prop(rays, "id", dataset_ulongint, true);
+	init_ray_prop(rays, "particleStatus", dataset_int, true);
 
-	DEBUG_END("INIT_RAYS")
+	store_gravity_direction(rays);
 }
 
 void
 raytracing::openPMD_io::init_write(std::string particle_species, unsigned long long int n_rays,
                                    unsigned int iter) {
+	if (_session != nullptr)
+		throw std::runtime_error("The writers of a session are initialized by the session");
+	close_write();
+	_read_plan.reset();
+	_replay_key.clear(); // the file is overwritten
 	_iter                = iter;
 	std::string filename = _name;
 	// assign the global variable to keep track of it
 	_series = std::unique_ptr<openPMD::Series>(
-	        new openPMD::Series(filename, openPMD::Access::CREATE));
+	        new openPMD::Series(filename, openPMD::Access::CREATE, series_options(true)));
+	_nsteps      = 0;
+	_stream_step = nullptr;
 
 	_series->setAuthor("openPMD raytracing API");
 	// latticeName: name of the instrument
@@ -142,8 +321,11 @@ raytracing::openPMD_io::init_write(std::string particle_species, unsigned long l
 
 	DEBUG_INFO("init_write", "Filename: " << filename)
 
-	auto i = iter_pmd(iter);
-	_series->flush();
+	// in streaming mode the iterations are only created through writeIterations()
+	if (!_isStreaming) {
+		auto i = iter_pmd(iter);
+		_series->flush();
+	}
 
 	//	openPMD::Record directionOfGravity;
 	///\todo I don't how to add the directionOfGravity
@@ -162,176 +344,369 @@ raytracing::openPMD_io::init_write(std::string particle_species, unsigned long l
 
 	//	mass_scalar.resetDataset(dataset);
 
-	_series->flush();
+	if (!_isStreaming) _series->flush();
 	DEBUG_INFO("init_write", "flush done")
 }
 
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::init_component(std::shared_ptr<openPMD::Series> series,
+                                       ray_session* session, const std::string& component,
+                                       std::string particle_species,
+                                       unsigned long long int n_rays, unsigned int iter) {
+	_series                 = series;
+	_session                = session;
+	_iter                   = iter;
+	_name_current_component = component;
+	_nsteps                 = 0;
+	_stream_step            = nullptr;
+	iter_pmd(iter).setAttribute("componentName", component);
+	init_rays(particle_species, n_rays, iter);
+}
+
+//------------------------------------------------------------
+openPMD::RecordComponent&
+raytracing::openPMD_io::record_pmd(openPMD::ParticleSpecies& rays, field_t field) {
+	const field_info& info = get_field_info(field);
+	return rays[info.record][info.component != nullptr ? info.component
+	                                                   : openPMD::RecordComponent::SCALAR];
+}
+
 //------------------------------------------------------------
 template <typename T>
 void
-save_write_single(openPMD::ParticleSpecies& rays, std::string field, std::string record,
-                  raytracing::openPMD_io::Rays::Record<T>& rec, openPMD::Offset& offset,
-                  openPMD::Extent& extent) {
-	rays[field][record].storeChunk(openPMD::shareRaw(rec.vals()), offset, extent);
-	rays[field][record].setAttribute("minValue", rec.min());
-	rays[field][record].setAttribute("maxValue", rec.max());
+raytracing::openPMD_io::save_write_single(openPMD::RecordComponent& data,
+                                          const Rays::Record<T>& rec, openPMD::Offset& offset,
+                                          openPMD::Extent& extent) {
+	// the data are not modified, but the openPMD API wants a non-const pointer
+	data.storeChunk(openPMD::shareRaw(const_cast<T*>(rec.data())), offset, extent);
 }
 //------------------------------------------------------------
 
+void
+raytracing::openPMD_io::store_rays(species_plan& plan, const Rays& chunk,
+                                   openPMD::Offset& offset, openPMD::Extent& extent) {
+	chunk.for_each([&](field_t field, const auto& rec) {
+		save_write_single(plan.components[field], rec, offset, extent);
+	});
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::store_summary(species_buffer& sp) {
+	species_plan& plan = *sp.plan;
+	sp.rays.for_each([&](field_t field, const auto& rec) {
+		plan.components[field].setAttribute("minValue", rec.min());
+		plan.components[field].setAttribute("maxValue", rec.max());
+	});
+
+	if (sp.population.is_enabled()) {
+		const population_control& pc = sp.population;
+		plan.species.setAttribute("populationControlFactor", pc.factor());
+		plan.species.setAttribute("populationControlSplitting", pc.splitting());
+		plan.species.setAttribute("populationControlGenerated", pc.generated());
+		plan.species.setAttribute("populationControlWeightIn", pc.weight_in());
+		plan.species.setAttribute("populationControlWeightOut", pc.weight_out());
+	}
+
+	if (_sort_key != kSortNone)
+		plan.species.setAttribute("sortKey", std::string(sort_key_name(_sort_key)));
+	if (!sp.sort_offsets.empty()) {
+		store_table(plan.species["sortChunkOffset"][openPMD::RecordComponent::SCALAR],
+		            sp.sort_offsets);
+		for (auto& range : sp.sort_min)
+			store_table(plan.species["sortChunkMinValue"][get_field_info(range.first).name],
+			            range.second);
+		for (auto& range : sp.sort_max)
+			store_table(plan.species["sortChunkMaxValue"][get_field_info(range.first).name],
+			            range.second);
+	}
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * In streaming mode the summary is written in each step: only the rays queued since the last
+ * full chunk are left, written in a last step.
+ */
+void
+raytracing::openPMD_io::close_write(void) {
+	if (_series && _isStreaming && !_write_species.empty()) save_write();
+	if (_series && !_isStreaming && !_write_species.empty()) {
+		save_write();
+		std::vector<std::string> index;
+		for (auto& sp : _write_species) {
+			store_summary(sp.second);
+			index.push_back(std::to_string(_iter) + " " + sp.first + " " +
+			                std::to_string(sp.second.nrays));
+		}
+		// the session writes the index of all its components at once
+		if (_session == nullptr) {
+			_series->setAttribute("rayIndex", index);
+			_series->flush();
+		} else
+			_session->add_index(index);
+	}
+	_write_species.clear();
+	_write_current = nullptr;
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The rays of all the particle species are written with a single flush (and a single step in
+ * streaming mode).
+ */
 void
 raytracing::openPMD_io::save_write(void) {
-	if (_rays.size() == 0) return;
+	// the components of a session are flushed together
+	if (_session != nullptr) {
+		_session->flush();
+		return;
+	}
+	if (!queue_pending()) return;
+	end_flush();
+	for (auto& sp : _write_species) {
+		sp.second.rays.clear_chunk();
+		sp.second.staged.clear_chunk();
+	}
+}
 
-	DEBUG_INFO("save_write",
-	           "Number of saved rays: " << _rays.size() << "\t" << _rays._x.vals().size())
+//------------------------------------------------------------
+bool
+raytracing::openPMD_io::queue_pending(void) {
+	bool pending = false;
+	for (auto& sp : _write_species) {
+		if (sp.second.staged.size() != 0) transform_staged(sp.second);
+		pending |= sp.second.rays.size() != 0 || sp.second.staged.size() != 0;
+	}
+	if (!pending) return false;
+
+	begin_flush();
+	for (auto& sp : _write_species) {
+		if (sp.second.rays.size() != 0) queue_rays(sp.first, sp.second, sp.second.rays);
+		if (sp.second.staged.size() != 0) queue_rays(sp.first, sp.second, sp.second.staged);
+	}
+	return true;
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::commit_pending(void) {
+	for (auto& sp : _write_species) {
+		sp.second.plan->species.setAttribute("numParticles", sp.second.nrays);
+		sp.second.rays.clear_chunk();
+		sp.second.staged.clear_chunk();
+	}
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::write_chunk(const Rays& chunk) {
+	save_write();
+	if (chunk.size() == 0) return;
+	species_buffer& sp = _write_species.at(_particle_species);
+	chunk.for_each([&](field_t field, const auto& rec) {
+		if (rec.size() != chunk.size())
+			throw std::runtime_error(std::string("Missing field in the chunk written: ") +
+			                         get_field_info(field).name);
+	});
+	if (_write_pipeline) {
+		// the chunk is transformed in a copy, written by save_write()
+		sp.staged.copy(chunk);
+		save_write();
+		return;
+	}
+	// keep track of the min-max values of all the rays written, from the values: the chunks
+	// read from file carry no range
+	sp.rays.for_each(chunk, [&](field_t, auto& rec, const auto& chunk_rec) {
+		auto range = std::minmax_element(chunk_rec.data(), chunk_rec.data() + chunk_rec.size());
+		rec.update_range(*range.first, *range.second);
+	});
+	begin_flush();
+	queue_rays(_particle_species, sp, chunk);
+	end_flush();
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::transform_staged(species_buffer& sp) {
+	_write_pipeline(sp.staged);
+	sp.rays.for_each(sp.staged, [&](field_t, auto& rec, const auto& staged_rec) {
+		if (staged_rec.size() != 0) rec.update_range(staged_rec.min(), staged_rec.max());
+	});
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::begin_flush(void) {
+	// each flush is a new step: the step is published to the readers when closed
+	if (_isStreaming) _stream_step = &_series->writeIterations()[_iter + _nsteps];
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::queue_rays(const std::string& particle_species, species_buffer& sp,
+                                   const Rays& chunk) {
+	DEBUG_INFO("save_write", "Number of saved rays for " << particle_species << ": "
+	                                                      << chunk.size())
 
-	auto rays = rays_pmd();
 	// this check is here and not in the trace_write because I believe that loosing time for a
 	// CHUNKSIZE simulating rays that are not store is much less frequent that.
-	if (_nrays + _rays.size() > _max_allowed_rays)
+	if (sp.nrays + chunk.size() > sp.max_rays)
 		throw std::runtime_error("Maximum number of foreseen rays reached, stopping");
 
 	// number of new rays being written
-#ifdef DEBUG
-	assert(_nrays == _offset[0]);
-#endif
-	_nrays += _rays.size();
-
-	openPMD::Extent extent = {_rays.size()};
-
-	save_write_single(rays, "position", "x", _rays._x, _offset, extent);
-	save_write_single(rays, "position", "y", _rays._y, _offset, extent);
-	save_write_single(rays, "position", "z", _rays._z, _offset, extent);
-
-	save_write_single(rays, "direction", "x", _rays._dx, _offset, extent);
-	save_write_single(rays, "direction", "y", _rays._dy, _offset, extent);
-	save_write_single(rays, "direction", "z", _rays._dz, _offset, extent);
-
-	save_write_single(rays, "nonPhotonPolarization", "x", _rays._sx, _offset, extent);
-	save_write_single(rays, "nonPhotonPolarization", "y", _rays._sy, _offset, extent);
-	save_write_single(rays, "nonPhotonPolarization", "z", _rays._sz, _offset, extent);
-
-	save_write_single(rays, "photonSPolarizationAmplitude", "x", _rays._sPolAx, _offset,
-	                  extent);
-	save_write_single(rays, "photonSPolarizationAmplitude", "y", _rays._sPolAy, _offset,
-	                  extent);
-	save_write_single(rays, "photonSPolarizationAmplitude", "z", _rays._sPolAz, _offset,
-	                  extent);
-	save_write_single(rays, "photonSPolarizationPhase", openPMD::RecordComponent::SCALAR,
-	                  _rays._sPolPh, _offset, extent);
-
-	save_write_single(rays, "photonPPolarizationAmplitude", "x", _rays._pPolAx, _offset,
-	                  extent);
-	save_write_single(rays, "photonPPolarizationAmplitude", "y", _rays._pPolAy, _offset,
-	                  extent);
-	save_write_single(rays, "photonPPolarizationAmplitude", "z", _rays._pPolAz, _offset,
-	                  extent);
-	save_write_single(rays, "photonPPolarizationPhase", openPMD::RecordComponent::SCALAR,
-	                  _rays._pPolPh, _offset, extent);
-
-	save_write_single(rays, "rayTime", openPMD::RecordComponent::SCALAR, _rays._time, _offset,
-	                  extent);
-	save_write_single(rays, "wavelength", openPMD::RecordComponent::SCALAR, _rays._wavelength,
-	                  _offset, extent);
-	save_write_single(rays, "weight", openPMD::RecordComponent::SCALAR, _rays._weight, _offset,
-	                  extent);
-
-	save_write_single(rays, "id", openPMD::RecordComponent::SCALAR, _rays._id, _offset, extent);
-	save_write_single(rays, "particleStatus", openPMD::RecordComponent::SCALAR, _rays._status,
-	                  _offset, extent);
-
-	rays.setAttribute("numParticles", _nrays);
+	openPMD::Extent extent = {chunk.size()};
+
+	if (_isStreaming) {
+		// the species is declared again in each step
+		auto& rays             = species_pmd(particle_species);
+		openPMD::Offset offset = {0};
+		declare_rays(rays, particle_species, chunk.size());
+		sp.plan.reset(new species_plan(rays));
+		store_rays(*sp.plan, sort_chunk(sp, chunk), offset, extent);
+		rays.setAttribute("numParticles", chunk.size());
+		store_summary(sp);
+	} else {
+		store_rays(*sp.plan, sort_chunk(sp, chunk), sp.offset, extent);
+		for (size_t i = 0; i < extent.size(); ++i)
+			sp.offset[i] += extent[i];
+	}
+	sp.nrays += chunk.size();
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::set_sort(sort_key_t key) {
+	_sort_key = key;
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::set_write_pipeline(transform_t pipeline) {
+	// a flush writes either the raw or the staged rays of a species, never both
+	save_write();
+	_write_pipeline = std::move(pipeline);
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The sorted chunk is kept in the species buffer until the flush, since storeChunk does not
+ * copy the data.
+ */
+const raytracing::openPMD_io::Rays&
+raytracing::openPMD_io::sort_chunk(species_buffer& sp, const Rays& chunk) {
+	if (_sort_key == kSortNone) return chunk;
+	permute(chunk, sort_permutation(chunk, _sort_key), sp.sorted);
+	if (_isStreaming) return sp.sorted; // each step is a single chunk
+
+	sp.sort_offsets.push_back(sp.offset[0]);
+	for (auto field : sort_fields(_sort_key)) {
+		sp.sorted.for_each([&](field_t f, const auto& rec) {
+			if (f != field) return;
+			sp.sort_min[field].push_back(rec.min());
+			sp.sort_max[field].push_back(rec.max());
+		});
+	}
+	return sp.sorted;
+}
 
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::end_flush(void) {
+	if (_isStreaming) {
+		_stream_step->close();
+		_stream_step = nullptr;
+		++_nsteps;
+		return;
+	}
 	_series->flush();
-	_rays.clear_chunk();
 
-	for (size_t i = 0; i < extent.size(); ++i)
-		_offset[i] += extent[i];
+	// numParticles is the commit marker: it is updated only once the data are on disk, so
+	// that a reader following the file never reads rays that have not been written yet
+	for (auto& sp : _write_species)
+		sp.second.plan->species.setAttribute("numParticles", sp.second.nrays);
+	_series->flush();
 }
 
 //------------------------------------------------------------
 //------------------------------------------------------------
 template <typename T>
 void
-read_single(openPMD::ParticleSpecies& rays, std::string field, std::string record,
-            raytracing::openPMD_io::Rays::Record<T>& rec, openPMD::Offset& offset,
-            openPMD::Extent& chunk_size) {
+raytracing::openPMD_io::read_single(openPMD::RecordComponent& data, Rays::Record<T>& rec,
+                                    openPMD::Offset& offset, openPMD::Extent& chunk_size) {
 
-	auto data = rays[field][record];
-	rec.vals().reserve(chunk_size[0]);
+	// the values are left uninitialized by the allocator of the records: loadChunk fills them
 	rec.vals().resize(chunk_size[0]);
-	data.loadChunk<T>(openPMD::shareRaw(rec.vals()), offset,
+	data.loadChunk<T>(openPMD::shareRaw(rec.vals().data()), offset,
 	                  chunk_size); // data.loadChunk<T>(offset, chunk_size);
-	// if (field == "position") {
-	// 	for (auto i = 0; i < chunk_size[0]; ++i) {
-	// 		std::cout << "Data " << record << ": " << i << "\t" << rec.vals()[i] << "\t"
-	// 		          << rec.vals().size() << std::endl;
-	// 	}
-	// }
-	// rec.store((ddata.get()), chunk_size[0],                              //
-	//           rays[field][record].getAttribute("minValue").get<float>(), //
-	//           rays[field][record].getAttribute("maxValue").get<float>());
 }
 //------------------------------------------------------------
 
+void
+raytracing::openPMD_io::load_rays(species_plan& plan, Rays& chunk, openPMD::Offset& offset,
+                                  openPMD::Extent& chunk_size, field_mask_t fields) {
+	/* I don't understand....
+	 * the data type info is embedded in the data... so why do we need to declare
+	 * loadChunk<float>? it should overload to the right function... and return the correct
+	 * datatype.
+	 */
+	chunk.for_each([&](field_t field, auto& rec) {
+		if (fields & field_bit(field))
+			read_single(plan.components[field], rec, offset, chunk_size);
+	});
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * When the pipeline filters out all the rays of a chunk, the next one is loaded, so that an
+ * empty chunk still means that all the rays have been read.
+ */
 void
 raytracing::openPMD_io::load_chunk(void) {
+	load_source();
+	while (_read_pipeline && _rays.size() != 0) {
+		_read_pipeline(_rays);
+		if (_rays.size() != 0) break;
+		load_source();
+	}
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::load_source(void) {
+	if (_isStreaming) {
+		load_step();
+		return;
+	}
+	if (!_sample.empty()) {
+		load_sampled();
+		return;
+	}
+	if (_columnar) {
+		load_columnar();
+		return;
+	}
+	if (_isReplaying) {
+		load_replay();
+		return;
+	}
 
 	_rays.clear(); // Necessary to set _read to zero
-	auto rays = rays_pmd();
 	DEBUG_START("load_chunk")
 
 	unsigned long long int remaining = _nrays - _offset[0];
-	openPMD::Extent chunk_size = {remaining > raytracing::CHUNK_SIZE ? raytracing::CHUNK_SIZE
-	                                                                 : remaining};
+	openPMD::Extent chunk_size = {remaining > _chunk_size ? _chunk_size : remaining};
 	DEBUG_INFO("load_chunk",
 	           _nrays << "\t" << _offset[0] << "\t" << remaining << "\t" << chunk_size[0])
 	DEBUG_INFO("load_chunk",
 	           "  Loading chunk of size " << chunk_size[0] << "; file contains " << _nrays)
-	/* I don't understand....
-	 * the data type info is embedded in the data... so why do we need to declare
-	 * loadChunk<float>? it should overload to the right function... and return the correct
-	 * datatype.
-	 */
-	read_single(rays, "position", "x", _rays._x, _offset, chunk_size);
-	read_single(rays, "position", "y", _rays._y, _offset, chunk_size);
-	read_single(rays, "position", "z", _rays._z, _offset, chunk_size);
-
-	read_single(rays, "direction", "x", _rays._dx, _offset, chunk_size);
-	read_single(rays, "direction", "y", _rays._dy, _offset, chunk_size);
-	read_single(rays, "direction", "z", _rays._dz, _offset, chunk_size);
-
-	read_single(rays, "nonPhotonPolarization", "x", _rays._sx, _offset, chunk_size);
-	read_single(rays, "nonPhotonPolarization", "y", _rays._sy, _offset, chunk_size);
-	read_single(rays, "nonPhotonPolarization", "z", _rays._sz, _offset, chunk_size);
-
-	read_single(rays, "photonSPolarizationAmplitude", "x", _rays._sPolAx, _offset, chunk_size);
-	read_single(rays, "photonSPolarizationAmplitude", "y", _rays._sPolAy, _offset, chunk_size);
-	read_single(rays, "photonSPolarizationAmplitude", "z", _rays._sPolAz, _offset, chunk_size);
-	read_single(rays, "photonSPolarizationPhase", openPMD::RecordComponent::SCALAR,
-	            _rays._sPolPh, _offset, chunk_size);
-
-	read_single(rays, "photonPPolarizationAmplitude", "x", _rays._pPolAx, _offset, chunk_size);
-	read_single(rays, "photonPPolarizationAmplitude", "y", _rays._pPolAy, _offset, chunk_size);
-	read_single(rays, "photonPPolarizationAmplitude", "z", _rays._pPolAz, _offset, chunk_size);
-	read_single(rays, "photonPPolarizationPhase", openPMD::RecordComponent::SCALAR,
-	            _rays._pPolPh, _offset, chunk_size);
-
-	read_single(rays, "rayTime", openPMD::RecordComponent::SCALAR, _rays._time, _offset,
-	            chunk_size);
-	read_single(rays, "wavelength", openPMD::RecordComponent::SCALAR, _rays._wavelength,
-	            _offset, chunk_size);
-	read_single(rays, "weight", openPMD::RecordComponent::SCALAR, _rays._weight, _offset,
-	            chunk_size);
-
-	read_single(rays, "id", openPMD::RecordComponent::SCALAR, _rays._id, _offset, chunk_size);
-	read_single(rays, "particleStatus", openPMD::RecordComponent::SCALAR, _rays._status,
-	            _offset, chunk_size);
-
-	_rays.size(chunk_size[0]);
-	DEBUG_INFO("load_chunk", "Before flush")
-	_series->flush();
-	DEBUG_INFO("load_chunk", "After flush")
+	if (!(_shared_cache && load_shared(chunk_size))) {
+		load_rays(*_read_plan, _rays, _offset, chunk_size, _read_fields);
+		_rays.size(chunk_size[0]);
+		DEBUG_INFO("load_chunk", "Before flush")
+		_series->flush();
+		DEBUG_INFO("load_chunk", "After flush")
+	}
 
 	//	std::cout << _rays._x[0] << "\t" << _rays._x[2] << std::endl;
 	for (size_t i = 0; i < chunk_size.size(); ++i)
@@ -339,48 +714,441 @@ raytracing::openPMD_io::load_chunk(void) {
 	DEBUG_END("load_chunk")
 }
 
+//------------------------------------------------------------
+/** \internal \remark
+ * The chunk is loaded from file directly into the shared memory by the first process, the
+ * records are then views on the shared memory for all the processes.
+ */
+bool
+raytracing::openPMD_io::load_shared(openPMD::Extent& chunk_size) {
+	auto fill = [&](void* const* columns) {
+		_rays.for_each([&](field_t field, auto& rec) {
+			typedef typename std::decay<decltype(rec)>::type::value_type T;
+			if (!(_read_fields & field_bit(field))) return;
+			_read_plan->components[field].loadChunk(
+			        openPMD::shareRaw(static_cast<T*>(columns[field])), _offset, chunk_size);
+		});
+		_series->flush();
+	};
+	if (!_shared_cache->get(_offset[0], chunk_size[0], fill)) return false;
+
+	// the min-max values are not used when reading
+	_rays.for_each([&](field_t field, auto& rec) {
+		typedef typename std::decay<decltype(rec)>::type::value_type T;
+		if (!(_read_fields & field_bit(field))) return;
+		rec.view(_shared_cache->column<T>(field, _offset[0]), chunk_size[0], rec.min(),
+		         rec.max());
+	});
+	_rays.size(chunk_size[0]);
+	return true;
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::set_shared_cache(bool enable, bool persistent) {
+	_isSharedCache           = enable;
+	_isSharedCachePersistent = persistent;
+}
+
+unsigned int
+raytracing::openPMD_io::purge_shared_cache(const std::string& filename) {
+	return shm_cache::purge(filename.empty() ? filename : canonical_path(filename) + "|");
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The native columnar file is memory mapped, so there is no need to load it in chunks: the
+ * records are views on the mapped memory for all the requested rays.
+ */
+void
+raytracing::openPMD_io::load_columnar(void) {
+	_rays.clear(); // Necessary to set _read to zero
+	size_t n = _nrays - _offset[0];
+	_rays.for_each([&](field_t field, auto& rec) {
+		typedef typename std::decay<decltype(rec)>::type::value_type T;
+		if (!(_read_fields & field_bit(field))) return;
+		rec.view(_columnar->column<T>(field) + _offset[0], n, _columnar->min<T>(field),
+		         _columnar->max<T>(field));
+	});
+	_rays.size(n);
+	_offset[0] += n;
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::set_replay(size_t budget, bool cycle) {
+	_replay_budget = budget;
+	_replay_cycle  = cycle;
+	if (budget == 0) {
+		_replay.clear();
+		_replay_key.clear();
+	}
+}
+
+//------------------------------------------------------------
+unsigned long long int
+raytracing::openPMD_io::init_replay(unsigned long long int n_rays) {
+	unsigned long long int n_file = _replay.size();
+	_isReplaying                  = true;
+	if (_replay_cycle) {
+		_nrays = (n_rays == 0) ? std::numeric_limits<unsigned long long int>::max() : n_rays;
+		return (n_rays == 0) ? n_file : n_rays;
+	}
+	if (n_rays > n_file)
+		throw std::runtime_error("Requested a number of rays that is not available");
+	_nrays = (n_rays == 0) ? n_file : n_rays;
+	return _nrays;
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The records are views on the in-memory buffer, up to its end: the whole buffer is a single
+ * chunk, or two when cycling from the middle of it.
+ */
+void
+raytracing::openPMD_io::load_replay(void) {
+	_rays.clear(); // Necessary to set _read to zero
+	size_t n_file = _replay.size();
+	size_t begin  = _offset[0] % n_file;
+	size_t n      = std::min<unsigned long long int>(_nrays - _offset[0], n_file - begin);
+	_rays.for_each(_replay, [&](field_t, auto& rec, const auto& all) {
+		if (all.size() != 0) rec.view(all.data() + begin, n, all.min(), all.max());
+	});
+	_rays.size(n);
+	_offset[0] += n;
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::set_sampling(sampling_t mode, unsigned long long int seed) {
+	_sampling      = mode;
+	_sampling_seed = seed;
+}
+
+//------------------------------------------------------------
+unsigned long long int
+raytracing::openPMD_io::init_sampling(unsigned long long int n_available,
+                                      unsigned long long int n_rays) {
+	if (n_rays == 0) n_rays = n_available;
+	std::mt19937_64 rng(_sampling_seed);
+	switch (_sampling) {
+	case kUniform:
+		_sample = sample_uniform(n_available, n_rays, rng);
+		break;
+	case kStratified:
+		_sample = sample_stratified(n_available, n_rays, rng);
+		break;
+	case kWeighted:
+		_sample = sample_weighted(n_available, n_rays);
+		return n_rays;
+	default:
+		throw std::runtime_error("Unknown sampling mode");
+	}
+	_sample_factor = static_cast<double>(n_available) / n_rays;
+	return n_rays;
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::load_weights(std::uint64_t begin, std::uint64_t count, float* weights) {
+	if (_columnar) {
+		const float* col = _columnar->column<float>(kWeight) + begin;
+		std::copy(col, col + count, weights);
+		return;
+	}
+	_read_plan->components[kWeight].loadChunk(openPMD::shareRaw(weights),
+	                                          openPMD::Offset{begin}, openPMD::Extent{count});
+	_series->flush();
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The alias table is built on the weight sums of blocks of rays, each block being a single
+ * ray unless the file has more than kMaxAliasEntries rays. The blocks are drawn first, then
+ * the rays within each drawn block proportionally to their weight, reading only the weights
+ * of the drawn blocks.
+ */
+std::vector<std::uint64_t>
+raytracing::openPMD_io::sample_weighted(std::uint64_t n_available, std::uint64_t n_rays) {
+	if (n_available == 0)
+		throw std::runtime_error("Cannot sample from a particle species without rays");
+	std::mt19937_64 rng(_sampling_seed);
+	std::uint64_t block    = (n_available + kMaxAliasEntries - 1) / kMaxAliasEntries;
+	std::uint64_t n_blocks = (n_available + block - 1) / block;
+
+	// one pass over the weight column
+	std::vector<double> sums(n_blocks, 0.);
+	std::vector<float> weights(
+	        std::min(std::max(block, kWeightPass / block * block), n_available));
+	for (std::uint64_t begin = 0; begin < n_available; begin += weights.size()) {
+		std::uint64_t count = std::min<std::uint64_t>(weights.size(), n_available - begin);
+		load_weights(begin, count, weights.data());
+		for (std::uint64_t i = 0; i < count; ++i)
+			sums[(begin + i) / block] += weights[i];
+	}
+	alias_table table(sums);
+	_sample_factor = table.total() / n_rays;
+
+	std::vector<std::uint64_t> sample(n_rays);
+	for (auto& s : sample)
+		s = table.draw(rng);
+	std::sort(sample.begin(), sample.end());
+	if (block == 1) return sample;
+
+	// the draws of the same block are next to each other
+	std::vector<double> cumulative;
+	std::uniform_real_distribution<double> uniform(0., 1.);
+	for (size_t i = 0; i < sample.size();) {
+		std::uint64_t b     = sample[i];
+		std::uint64_t begin = b * block;
+		std::uint64_t count = std::min(block, n_available - begin);
+		load_weights(begin, count, weights.data());
+		cumulative.resize(count);
+		std::partial_sum(weights.begin(), weights.begin() + count, cumulative.begin());
+		for (; i < sample.size() && sample[i] == b; ++i) {
+			auto it = std::upper_bound(cumulative.begin(), cumulative.end(),
+			                           uniform(rng) * cumulative.back());
+			sample[i] = begin + std::min<std::uint64_t>(it - cumulative.begin(), count - 1);
+		}
+	}
+	std::sort(sample.begin(), sample.end());
+	return sample;
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * In sampled mode _offset counts the selected rays read so far. Selected rays closer than
+ * kSampleGap in the file are read with a single loadChunk per record, and the rays in between
+ * are discarded: a few more bytes are read, but the number of requests to the backend is
+ * much lower.
+ */
+void
+raytracing::openPMD_io::load_sampled(void) {
+	_rays.clear(); // Necessary to set _read to zero
+	size_t begin = _offset[0];
+	size_t end   = std::min<size_t>(begin + _chunk_size, _nrays);
+
+	if (_columnar) {
+		_rays.for_each([&](field_t field, auto& rec) {
+			typedef typename std::decay<decltype(rec)>::type::value_type T;
+			if (!(_read_fields & field_bit(field))) return;
+			const T* col = _columnar->column<T>(field);
+			for (size_t i = begin; i < end; ++i)
+				rec.push_back(col[_sample[i]]);
+		});
+	} else {
+		struct run_t {
+			size_t first, last; // selected rays of the run
+		};
+		std::vector<run_t> runs;
+		std::vector<Rays> buffers;
+		buffers.reserve(end - begin); // the loads are pending: no reallocation allowed
+
+		for (size_t i = begin; i < end;) {
+			size_t j = i + 1;
+			while (j < end && _sample[j] - _sample[j - 1] <= kSampleGap)
+				++j;
+			openPMD::Offset offset = {_sample[i]};
+			openPMD::Extent extent = {_sample[j - 1] - _sample[i] + 1};
+			buffers.emplace_back();
+			load_rays(*_read_plan, buffers.back(), offset, extent, _read_fields);
+			runs.push_back({i, j});
+			i = j;
+		}
+		_series->flush();
+
+		for (size_t r = 0; r < runs.size(); ++r) {
+			std::uint64_t start = _sample[runs[r].first];
+			_rays.for_each(buffers[r], [&](field_t, auto& rec, const auto& buffer) {
+				if (buffer.size() == 0) return; // not loaded
+				for (size_t i = runs[r].first; i < runs[r].last; ++i)
+					rec.push_back(buffer.vals()[_sample[i] - start]);
+			});
+		}
+	}
+
+	// the selected rays represent all the others
+	_rays.for_each([&](field_t field, auto& rec) {
+		if (field != kWeight) return;
+		for (auto& w : rec.vals())
+			w = (_sampling == kWeighted) ? _sample_factor : w * _sample_factor;
+	});
+	_rays.size(end - begin);
+	_offset[0] = end;
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * In streaming mode _offset counts the rays read so far over all the steps, while each step is
+ * read from its beginning. The previous step is released only when the next one is requested,
+ * so that the iterator does not block before it is needed.
+ */
+void
+raytracing::openPMD_io::load_step(void) {
+	DEBUG_START("load_step")
+	_rays.clear(); // Necessary to set _read to zero
+	_rays.size(0);
+
+	while (_offset[0] < _nrays && *_stream_it != *_stream_end) {
+		if (_stream_step != nullptr) {
+			// the previous step has been consumed, release it and wait for the next one
+			_stream_step = nullptr;
+			++(*_stream_it);
+			continue;
+		}
+		auto& step   = **_stream_it;
+		_stream_step = &step;
+		if (step.iterationIndex < _iter) continue; // skip the steps before the requested one
+		if (!step.particles.contains(_particle_species)) continue;
+
+		auto rays = rays_pmd();
+		unsigned long long int remaining = _nrays - _offset[0];
+		unsigned long long int n_step =
+		        rays.getAttribute("numParticles").get<unsigned long long int>();
+		openPMD::Offset offset     = {0};
+		openPMD::Extent chunk_size = {remaining > n_step ? n_step : remaining};
+		DEBUG_INFO("load_step", "Step " << step.iterationIndex << " with " << n_step << " rays")
+		if (chunk_size[0] == 0) continue;
+
+		species_plan plan(rays);
+		load_rays(plan, _rays, offset, chunk_size, _read_fields);
+		openPMD::Extent single = {1};
+		rays["directionOfGravity"]["x"].loadChunk(openPMD::shareRaw(&_gravity[Ray::X]), offset,
+		                                          single);
+		rays["directionOfGravity"]["y"].loadChunk(openPMD::shareRaw(&_gravity[Ray::Y]), offset,
+		                                          single);
+		rays["directionOfGravity"]["z"].loadChunk(openPMD::shareRaw(&_gravity[Ray::Z]), offset,
+		                                          single);
+		step.close(); // flushes the pending loads and ends the step
+		_rays.size(chunk_size[0]);
+		_offset[0] += chunk_size[0];
+		++_nsteps;
+		break;
+	}
+	DEBUG_END("load_step")
+}
+
 unsigned long long int
 raytracing::openPMD_io::init_read(std::string particle_species, unsigned int iter,
                                   unsigned long long int n_rays, unsigned int repeat) {
 
+	if (_session != nullptr) throw std::runtime_error("The writers of a session cannot read");
 	_n_repeat            = repeat;
 	_i_repeat            = 0;
 	_iter                = iter;
 	_offset              = {0};
 	std::string filename = _name;
 
-	// assign the global variable to keep track of it
-	_series = std::unique_ptr<openPMD::Series>(new openPMD::Series(
-	        filename,
-	        openPMD::Access::READ_ONLY)); ///\todo the file access type was defined in
-	                                      /// the openPMD_io constructor
-
-	std::cout << "File information: " << filename << std::endl;
-	if (_series->containsAttribute("author"))
-		std::cout << "  Author  : " << _series->author() << std::endl;
-	std::cout << "  Filename: " << filename << std::endl;
-	std::cout << "  Number of iterations: " << _series->iterations.size() << std::endl;
-
-	if (_series->iterations.size() == 0)
-		std::cout << "  ERROR, no iterations found in openPMD series" << std::endl;
+	close_write();
+	_read_plan.reset();
+	_columnar.reset();
+	_shared_cache.reset();
+	_sample.clear();
+	_isReplaying = false;
+	// the weights of the sampled rays are rescaled
+	_read_fields = _projection | (_sampling != kSequential ? field_bit(kWeight) : 0);
+	if (_sampling != kSequential && (_isStreaming || _isFollowing))
+		throw std::runtime_error(
+		        "Sampled reading is not available in streaming and follow modes");
+	// the same file can be reached with different paths
+	_cache_key = canonical_path(filename) + "|" + std::to_string(iter) + "|" + particle_species;
+	if (columnar_file::is_columnar(filename)) {
+		// native layout: no need of the openPMD API
+		_rays.clear();
+		_series.reset();
+		_columnar.reset(new columnar_file(filename));
+		if (_columnar->particle_species() != particle_species ||
+		    _columnar->header().iteration != iter)
+			throw std::runtime_error("Particle species or iteration not found in " +
+			                         filename);
+		_particle_species = particle_species;
+		_nrays            = _columnar->header().n_rays;
+		if (n_rays > _nrays && _sampling != kWeighted)
+			throw std::runtime_error("Requested a number of rays that is not available");
+		if (_sampling != kSequential) return _nrays = init_sampling(_nrays, n_rays);
+		if (n_rays != 0) _nrays = n_rays;
+		return _nrays;
+	}
 
-	///\todo check if the iteration exists
+	bool replay = _replay_budget != 0 && _sampling == kSequential && !_isStreaming &&
+	              !_isFollowing;
+	std::string replay_key = _cache_key + "|" + std::to_string(_read_fields);
+	if (replay && _series && replay_key == _replay_key) {
+		// the rays are already in memory, the series is still open for the attributes
+		_rays.clear();
+		_particle_species = particle_species;
+		return init_replay(n_rays);
+	}
 
-	// check the maximum number of rays stored
+	// assign the global variable to keep track of it
+	_series = std::unique_ptr<openPMD::Series>(new openPMD::Series(
+	        filename, openPMD::Access::READ_ONLY,
+	        series_options(false))); ///\todo the file access type was defined in
+	                                 /// the openPMD_io constructor
+	_nsteps      = 0;
+	_stream_step = nullptr;
 	_rays.clear(); // Necessary to set _read to zero
 
-	auto i = iter_pmd(_iter);
-	_series->flush();
-	auto rays = rays_pmd(particle_species);
-	_nrays    = rays.getAttribute("numParticles").get<unsigned long long int>();
-	std::cout << "numParticles: " << _nrays << std::endl;
-	if (n_rays > _nrays) {
+	if (_isStreaming) {
+		// the total number of rays is not known in advance: steps are read as they come
+		_particle_species = particle_species;
+		_nrays = (n_rays == 0) ? std::numeric_limits<unsigned long long int>::max() : n_rays;
+		auto steps        = _series->readIterations();
+		_stream_it.reset(new openPMD::SeriesIterator(steps.begin()));
+		_stream_end.reset(new openPMD::SeriesIterator(steps.end()));
+		return n_rays;
+	}
+
+	DEBUG_INFO("init_read", "File information: " << filename)
+	if (_series->containsAttribute("author")) {
+		DEBUG_INFO("init_read", "  Author  : " << _series->author())
+	}
+	DEBUG_INFO("init_read", "  Number of iterations: " << _series->iterations.size())
+
+	_particle_species = particle_species;
+	auto& rays        = open_species();
+	_read_plan.reset(new species_plan(rays));
+	_nrays            = rays.getAttribute("numParticles").get<unsigned long long int>();
+	DEBUG_INFO("init_read", "numParticles: " << _nrays)
+	_follow_limit = n_rays;
+	if (_isFollowing) {
+		// more rays are going to be committed by the writer: the returned value is the number
+		// of rays available now
+		if (n_rays != 0 && n_rays < _nrays) _nrays = n_rays;
+		return _nrays;
+	}
+	if (replay) {
+		size_t bytes = 0; // per ray
+		for (unsigned int f = 0; f < kNFields; ++f)
+			if (_read_fields & field_bit(field_t(f))) bytes += get_field_info(field_t(f)).size;
+		if (_nrays != 0 && _nrays * bytes <= _replay_budget) {
+			_replay.clear();
+			openPMD::Offset offset = {0};
+			openPMD::Extent extent = {_nrays};
+			load_rays(*_read_plan, _replay, offset, extent, _read_fields);
+			_series->flush();
+			_replay.size(_nrays);
+			_replay_key = replay_key;
+			return init_replay(n_rays);
+		}
+		std::cout << "[WARNING] " << _nrays << " rays do not fit in the replay budget, "
+		          << "they are read from file" << std::endl;
+	}
+	if (n_rays > _nrays && _sampling != kWeighted) {
 		std::cerr << "[ERROR] Requested a number of rays that is not available in "
 		             "the "
 		             "current file"
 		          << std::endl;
 		throw std::runtime_error("ERROR"); ///\todo make it more meaningful
 	}
+	if (_isSharedCache && _sampling == kSequential)
+		_shared_cache = shm_cache::attach(_cache_key + "|" + std::to_string(_read_fields),
+		                                  _nrays, _isSharedCachePersistent);
+	if (_sampling != kSequential) {
+		_nrays = init_sampling(_nrays, n_rays);
+		_series->flush();
+		return _nrays;
+	}
 	if (n_rays != 0) {
 		std::cout << "[WARNING] Requested " << n_rays
 		          << ", while available in file: " << _nrays << std::endl;
@@ -390,18 +1158,151 @@ raytracing::openPMD_io::init_read(std::string particle_species, unsigned int ite
 	return _nrays;
 }
 
+//------------------------------------------------------------
+/** \internal \remark
+ * The series is opened with deferred iteration parsing: only the requested iteration is
+ * parsed here, whatever the number of iterations in the file.
+ */
+openPMD::ParticleSpecies&
+raytracing::openPMD_io::open_species(void) {
+	if (!_series->iterations.contains(_iter))
+		throw std::runtime_error("Iteration " + std::to_string(_iter) + " not found in " +
+		                         _name);
+	auto& i = _series->iterations[_iter];
+	i.open();
+	if (!i.particles.contains(_particle_species))
+		throw std::runtime_error("Particle species " + _particle_species +
+		                         " not found in iteration " + std::to_string(_iter) +
+		                         " of " + _name);
+	return i.particles[_particle_species];
+}
+
+//------------------------------------------------------------
+raytracing::openPMD_io::file_index_t
+raytracing::openPMD_io::file_index(void) const {
+	file_index_t index;
+	if (columnar_file::is_columnar(_name)) {
+		columnar_file file(_name);
+		index[file.header().iteration][file.particle_species()] = file.header().n_rays;
+		return index;
+	}
+
+	openPMD::Series series(_name, openPMD::Access::READ_ONLY,
+	                       R"({"defer_iteration_parsing": true})");
+	if (series.containsAttribute("rayIndex")) {
+		// "iteration particle_species n_rays", written when closing the file
+		for (auto& entry : series.getAttribute("rayIndex").get<std::vector<std::string>>()) {
+			std::istringstream fields(entry);
+			unsigned int iter;
+			std::string particle_species;
+			unsigned long long int n_rays;
+			if (fields >> iter >> particle_species >> n_rays)
+				index[iter][particle_species] = n_rays;
+		}
+		return index;
+	}
+
+	// written by another code: all the iterations are parsed
+	for (auto& i : series.iterations) {
+		i.second.open();
+		for (auto& sp : i.second.particles)
+			index[i.first][sp.first] =
+			        sp.second.containsAttribute("numParticles")
+			                ? sp.second.getAttribute("numParticles")
+			                          .get<unsigned long long int>()
+			                : sp.second["position"]["x"].getExtent()[0];
+	}
+	return index;
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::set_follow(bool follow, double timeout, double poll) {
+	_isFollowing    = follow;
+	_follow_timeout = timeout;
+	_follow_poll    = poll;
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The file is re-opened at each poll, since the attributes are cached by the openPMD API and
+ * the writer might have been in the middle of a flush when opening it.
+ */
+void
+raytracing::openPMD_io::follow_commits(void) {
+	auto start = std::chrono::steady_clock::now();
+	while (_follow_limit == 0 || _nrays < _follow_limit) {
+		unsigned long long int committed = _nrays, declared = 0;
+		try {
+			_read_plan.reset();
+			_series.reset();
+			_series = std::unique_ptr<openPMD::Series>(new openPMD::Series(
+			        _name, openPMD::Access::READ_ONLY, series_options(false)));
+			auto& rays = open_species();
+			_read_plan.reset(new species_plan(rays));
+			committed = rays.getAttribute("numParticles").get<unsigned long long int>();
+			declared  = rays["position"]["x"].getExtent()[0];
+		} catch (std::exception& e) {
+			DEBUG_INFO("follow_commits", "file not readable yet: " << e.what())
+		}
+		if (committed > _nrays) {
+			_nrays = (_follow_limit != 0 && committed > _follow_limit) ? _follow_limit
+			                                                           : committed;
+			return;
+		}
+		if (declared != 0 && committed >= declared) return; // the writer is done
+
+		std::chrono::duration<double> waited = std::chrono::steady_clock::now() - start;
+		if (waited.count() >= _follow_timeout) return;
+		std::this_thread::sleep_for(std::chrono::duration<double>(_follow_poll));
+	}
+}
+
 void
 raytracing::openPMD_io::trace_write(raytracing::Ray this_ray) {
-	if (_rays.size() == CHUNK_SIZE) {
+	trace_write(_particle_species, this_ray);
+}
 
-		DEBUG_INFO("trace_write",
-		           "Reached CHUNK_SIZE:\toff=" << _offset[0] << "\tsize=" << _rays.size()
-		                                       << "\tmax=" << _max_allowed_rays)
+void
+raytracing::openPMD_io::trace_write(const std::string& particle_species,
+                                    raytracing::Ray this_ray) {
+	// the last species used is cached to avoid a lookup per ray
+	if (_write_current == nullptr || particle_species != _write_current_name) {
+		auto sp = _write_species.find(particle_species);
+		if (sp == _write_species.end())
+			throw std::runtime_error("Particle species " + particle_species +
+			                         " not initialized, call init_rays() first");
+		_write_current      = &sp->second;
+		_write_current_name = particle_species;
+	}
+	// with a write pipeline the rays are staged, the summary is the one of the transformed rays
+	Rays& rays            = _write_pipeline ? _write_current->staged : _write_current->rays;
+	unsigned int n_copies = 1;
+	if (_write_current->population.is_enabled()) {
+		float weight;
+		n_copies = _write_current->population.sample(this_ray.get_weight(), &weight);
+		this_ray.set_weight(weight);
+	}
+	for (unsigned int i = 0; i < n_copies; ++i) {
+		if (rays.size() == _chunk_size) {
 
-		save_write();
-		_rays.clear_chunk(); // clear the vector content but not the min-max values
+			DEBUG_INFO("trace_write", "Reached CHUNK_SIZE:\toff="
+			                                  << _write_current->offset[0] << "\tsize="
+			                                  << rays.size()
+			                                  << "\tmax=" << _write_current->max_rays)
+
+			save_write(); // clear the vector content but not the min-max values
+		}
+		rays.push(this_ray);
 	}
-	_rays.push(this_ray);
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_io::set_population_control(unsigned long long int n_generated,
+                                               bool splitting, unsigned long long int seed) {
+	species_buffer& sp = _write_species.at(_particle_species);
+	sp.population.init(sp.max_rays, n_generated, splitting, seed);
 }
 
 raytracing::Ray
@@ -412,6 +1313,10 @@ raytracing::openPMD_io::trace_read(void) {
 	                                          << _rays.is_chunk_finished())
 	if (_i_repeat++ == 0) {
 		if (_rays.is_chunk_finished()) { load_chunk(); }
+		if (_rays.is_chunk_finished()) {
+			_i_repeat = 0;
+			throw std::runtime_error("No more rays to be read");
+		}
 		_last_ray = _rays.pop();
 	}
 	if (_i_repeat >= _n_repeat) _i_repeat = 0;
@@ -420,19 +1325,83 @@ raytracing::openPMD_io::trace_read(void) {
 	return _last_ray;
 }
 
+const raytracing::openPMD_io::Rays&
+raytracing::openPMD_io::read_chunk(void) {
+	_i_repeat = 0;
+	if (is_read_finished()) {
+		_rays.clear();
+		return _rays;
+	}
+	// in streaming mode the next chunk might have been already loaded by is_read_finished()
+	if (_rays.is_chunk_finished()) load_chunk();
+	_rays.mark_read();
+	return _rays;
+}
+
+void
+raytracing::openPMD_io::seek(unsigned long long int ray) {
+	if (_isStreaming || !_sample.empty())
+		throw std::runtime_error("Seek is not available in streaming and sampled modes");
+	if (ray > _nrays) throw std::runtime_error("Seek beyond the rays to be read");
+	_offset   = {ray};
+	_i_repeat = 0;
+	_rays.clear(); // the next read loads a new chunk
+}
+
+bool
+raytracing::openPMD_io::is_read_finished(void) {
+	if (_i_repeat != 0 || !_rays.is_chunk_finished()) return false;
+	if (!_isStreaming) {
+		if (_isFollowing && _offset[0] >= _nrays) follow_commits();
+		if (!_read_pipeline || _offset[0] >= _nrays) return _offset[0] >= _nrays;
+	}
+	// the only way to know if the writer has published another step, or if the pipeline
+	// keeps any of the rays left, is to load them
+	load_chunk();
+	return _rays.is_chunk_finished();
+}
+
 void
 raytracing::openPMD_io::set_gravity_direction(float x, float y, float z) {
-	auto rays              = rays_pmd();
+	_gravity[Ray::X] = x;
+	_gravity[Ray::Y] = y;
+	_gravity[Ray::Z] = z;
+	// in streaming mode it is written in each step
+	if (_isStreaming) return;
+
+	for (auto& sp : _write_species)
+		store_gravity_direction(sp.second.plan->species);
+	_series->flush();
+}
+
+void
+raytracing::openPMD_io::store_gravity_direction(openPMD::ParticleSpecies& rays) {
 	openPMD::Offset offset = {0};
 	openPMD::Extent extent = {1};
-	rays["directionOfGravity"]["x"].storeChunk(openPMD::shareRaw(&x), offset, extent);
-	rays["directionOfGravity"]["y"].storeChunk(openPMD::shareRaw(&y), offset, extent);
-	rays["directionOfGravity"]["z"].storeChunk(openPMD::shareRaw(&z), offset, extent);
-	_series->flush();
+	rays["directionOfGravity"]["x"].storeChunk(openPMD::shareRaw(&_gravity[Ray::X]), offset,
+	                                           extent);
+	rays["directionOfGravity"]["y"].storeChunk(openPMD::shareRaw(&_gravity[Ray::Y]), offset,
+	                                           extent);
+	rays["directionOfGravity"]["z"].storeChunk(openPMD::shareRaw(&_gravity[Ray::Z]), offset,
+	                                           extent);
 }
 
 void
 raytracing::openPMD_io::get_gravity_direction(float* x, float* y, float* z) {
+	if (_columnar) {
+		*x = _columnar->header().gravity[Ray::X];
+		*y = _columnar->header().gravity[Ray::Y];
+		*z = _columnar->header().gravity[Ray::Z];
+		return;
+	}
+	if (_isStreaming) {
+		// the steps are closed once read, the value is cached when loading them
+		if (_nsteps == 0) load_chunk();
+		*x = _gravity[Ray::X];
+		*y = _gravity[Ray::Y];
+		*z = _gravity[Ray::Z];
+		return;
+	}
 	auto rays = rays_pmd();
 	auto xx   = rays["directionOfGravity"]["x"].loadChunk<float>();
 	auto yy   = rays["directionOfGravity"]["y"].loadChunk<float>();
@@ -0,0 +1,308 @@
+#include "openPMD_io_c.h"
+#include "openPMD_io.hh"
+#include "ray_units.hh"
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+///\file
+
+using raytracing::openPMD_io;
+
+struct openpmd_rays {
+	std::unique_ptr<openPMD_io> io;
+	bool isWriteMode;
+	double length_scale = 1., time_scale = 1.; // user units to cm and ms
+	openPMD_io::Rays chunk;                     // rays buffered until the chunk size
+	const openPMD_io::Rays* current = nullptr;  // chunk being read
+	size_t read = 0;                            // rays of the current chunk already read
+};
+
+namespace {
+thread_local std::string last_error;
+// the wavelengths are exchanged in Å
+constexpr double kAngstrom = raytracing::units::factor<raytracing::units::angstrom,
+                                                       raytracing::units::file_wavelength>();
+
+/// calls f() and converts the exceptions into an error code
+template <typename F>
+auto
+guard(F&& f, decltype(f()) error) -> decltype(f()) {
+	try {
+		last_error.clear();
+		return f();
+	} catch (std::exception& e) {
+		last_error = e.what();
+	} catch (...) {
+		last_error = "unknown error";
+	}
+	return error;
+}
+
+void
+check(openpmd_rays* h, bool isWriteMode) {
+	if (h == nullptr) throw std::runtime_error("Invalid handle");
+	if (h->isWriteMode != isWriteMode)
+		throw std::runtime_error(isWriteMode ? "The file is open for reading"
+		                                     : "The file is open for writing");
+}
+
+/// throws if one of the arrays required is NULL
+void
+check_arrays(std::initializer_list<const double*> arrays) {
+	for (auto a : arrays)
+		if (a == nullptr) throw std::runtime_error("NULL array of a required ray property");
+}
+
+/// writes the rays buffered, all of them or only a full chunk
+void
+flush(openpmd_rays* h, bool all) {
+	if (h->chunk.size() == 0 || (!all && h->chunk.size() < h->io->get_chunk_size())) return;
+	h->io->write_chunk(h->chunk);
+	h->chunk.clear();
+}
+
+/// values scaled into a temporary buffer
+std::vector<double>
+scaled(const double* in, size_t n, double scale) {
+	std::vector<double> out(in, in + n);
+	for (auto& v : out)
+		v *= scale;
+	return out;
+}
+
+/// copies m values of a record from first, divided by scale, when out is not null
+template <typename T, typename U>
+void
+copy_out(const openPMD_io::Rays::Record<T>& rec, size_t first, size_t m, U* out,
+         double scale = 1.) {
+	if (out == nullptr) return;
+	if (rec.size() == 0) throw std::runtime_error("Field not loaded");
+	double f = 1. / scale;
+	for (size_t i = 0; i < m; ++i)
+		out[i] = rec[first + i] * f;
+}
+
+/// next rays of the file: calls f(chunk, first, m) with at most n rays, returns m
+template <typename F>
+long long
+read_next(openpmd_rays* h, size_t n, F&& f) {
+	check(h, false);
+	if (h->current == nullptr || h->read == h->current->size()) {
+		h->current = &h->io->read_chunk();
+		h->read    = 0;
+	}
+	size_t m = std::min(n, h->current->size() - h->read);
+	f(*h->current, h->read, m);
+	h->read += m;
+	return static_cast<long long>(m);
+}
+} // namespace
+
+//------------------------------------------------------------
+openpmd_rays*
+openpmd_rays_open_write(const char* filename, const char* mc_code_name,
+                        const char* particle_species, unsigned long long n_rays,
+                        unsigned int iter) {
+	return guard(
+	        [&]() {
+		        std::unique_ptr<openpmd_rays> h(new openpmd_rays);
+		        h->io.reset(new openPMD_io(filename, mc_code_name));
+		        h->isWriteMode = true;
+		        h->io->init_write(particle_species, n_rays, iter);
+		        return h.release();
+	        },
+	        static_cast<openpmd_rays*>(nullptr));
+}
+
+//------------------------------------------------------------
+openpmd_rays*
+openpmd_rays_open_read(const char* filename, const char* particle_species, unsigned int iter,
+                       unsigned long long n_rays, unsigned long long* n_available) {
+	return guard(
+	        [&]() {
+		        std::unique_ptr<openpmd_rays> h(new openpmd_rays);
+		        h->io.reset(new openPMD_io(filename));
+		        h->isWriteMode = false;
+		        auto n         = h->io->init_read(particle_species, iter, n_rays);
+		        if (n_available != nullptr) *n_available = n;
+		        return h.release();
+	        },
+	        static_cast<openpmd_rays*>(nullptr));
+}
+
+//------------------------------------------------------------
+int
+openpmd_rays_close(openpmd_rays* h) {
+	// the errors are reported before the handle is released, not swallowed by the destructor
+	int status = guard(
+	        [&]() {
+		        if (h == nullptr) throw std::runtime_error("Invalid handle");
+		        if (h->isWriteMode) {
+			        flush(h, true);
+			        h->io->close_write();
+		        }
+		        return 0;
+	        },
+	        -1);
+	delete h;
+	return status;
+}
+
+//------------------------------------------------------------
+int
+openpmd_rays_set_units(openpmd_rays* h, double length_to_cm, double time_to_ms) {
+	return guard(
+	        [&]() {
+		        if (h == nullptr) throw std::runtime_error("Invalid handle");
+		        if (length_to_cm == 0. || time_to_ms == 0.)
+			        throw std::runtime_error("The unit scale factors cannot be zero");
+		        h->length_scale = length_to_cm;
+		        h->time_scale   = time_to_ms;
+		        return 0;
+	        },
+	        -1);
+}
+
+//------------------------------------------------------------
+int
+openpmd_rays_set_gravity(openpmd_rays* h, double x, double y, double z) {
+	return guard(
+	        [&]() {
+		        check(h, true);
+		        h->io->set_gravity_direction(x, y, z);
+		        return 0;
+	        },
+	        -1);
+}
+
+//------------------------------------------------------------
+int
+openpmd_rays_write(openpmd_rays* h, size_t n, const double* x, const double* y, const double* z,
+                   const double* dx, const double* dy, const double* dz,
+                   const double* wavelength, const double* time, const double* weight,
+                   const unsigned long long* id) {
+	using raytracing::detail::append_column;
+	using raytracing::detail::append_constant;
+	return guard(
+	        [&]() {
+		        check(h, true);
+		        check_arrays({x, y, z, dx, dy, dz, wavelength, time, weight});
+		        auto& c     = h->chunk;
+		        auto column = [n](openPMD_io::Rays::Record<float>& rec, const double* in,
+		                          double scale) {
+			        append_column(rec, n, [&](float* out) {
+				        for (size_t i = 0; i < n; ++i)
+					        out[i] = in[i] * scale;
+			        });
+		        };
+		        column(c._x, x, h->length_scale);
+		        column(c._y, y, h->length_scale);
+		        column(c._z, z, h->length_scale);
+		        column(c._dx, dx, 1.);
+		        column(c._dy, dy, 1.);
+		        column(c._dz, dz, 1.);
+		        for (auto* r : {&c._sx, &c._sy, &c._sz, &c._sPolAx, &c._sPolAy, &c._sPolAz,
+		                        &c._sPolPh, &c._pPolAx, &c._pPolAy, &c._pPolAz, &c._pPolPh})
+			        append_constant(*r, n, 0.f);
+		        column(c._wavelength, wavelength, kAngstrom);
+		        column(c._time, time, h->time_scale);
+		        column(c._weight, weight, 1.);
+		        if (id != nullptr)
+			        append_column(c._id, n, [&](unsigned long long* out) {
+				        std::copy(id, id + n, out);
+			        });
+		        else
+			        append_constant(c._id, n, 0ull);
+		        append_constant(c._status, n, raytracing::particleStatus_t(raytracing::kAlive));
+		        c.size(c._x.size());
+		        flush(h, false);
+		        return 0;
+	        },
+	        -1);
+}
+
+//------------------------------------------------------------
+int
+openpmd_rays_write_neutrons(openpmd_rays* h, size_t n, const double* x, const double* y,
+                            const double* z, const double* vx, const double* vy,
+                            const double* vz, const double* t, const double* p,
+                            const double* sx, const double* sy, const double* sz) {
+	namespace units = raytracing::units;
+	return guard(
+	        [&]() {
+		        check(h, true);
+		        check_arrays({x, y, z, vx, vy, vz, t, p});
+		        // the user units are scaled first, the file units are then kept as they are
+		        auto xs = scaled(x, n, h->length_scale), ys = scaled(y, n, h->length_scale),
+		             zs = scaled(z, n, h->length_scale), ts = scaled(t, n, h->time_scale);
+		        raytracing::push_mcstas_neutrons<units::file_length, units::file_time>(
+		                h->chunk, n, xs.data(), ys.data(), zs.data(), vx, vy, vz, ts.data(),
+		                p, sx, sy, sz);
+		        flush(h, false);
+		        return 0;
+	        },
+	        -1);
+}
+
+//------------------------------------------------------------
+long long
+openpmd_rays_read(openpmd_rays* h, size_t n, double* x, double* y, double* z, double* dx,
+                  double* dy, double* dz, double* wavelength, double* time, double* weight,
+                  unsigned long long* id) {
+	return guard(
+	        [&]() {
+		        return read_next(h, n, [&](const openPMD_io::Rays& c, size_t first, size_t m) {
+			        copy_out(c._x, first, m, x, h->length_scale);
+			        copy_out(c._y, first, m, y, h->length_scale);
+			        copy_out(c._z, first, m, z, h->length_scale);
+			        copy_out(c._dx, first, m, dx);
+			        copy_out(c._dy, first, m, dy);
+			        copy_out(c._dz, first, m, dz);
+			        copy_out(c._wavelength, first, m, wavelength, kAngstrom);
+			        copy_out(c._time, first, m, time, h->time_scale);
+			        copy_out(c._weight, first, m, weight);
+			        copy_out(c._id, first, m, id);
+		        });
+	        },
+	        -1LL);
+}
+
+//------------------------------------------------------------
+long long
+openpmd_rays_read_neutrons(openpmd_rays* h, size_t n, double* x, double* y, double* z,
+                           double* vx, double* vy, double* vz, double* t, double* p,
+                           double* sx, double* sy, double* sz) {
+	return guard(
+	        [&]() {
+		        return read_next(h, n, [&](const openPMD_io::Rays& c, size_t first, size_t m) {
+			        copy_out(c._x, first, m, x, h->length_scale);
+			        copy_out(c._y, first, m, y, h->length_scale);
+			        copy_out(c._z, first, m, z, h->length_scale);
+			        if (vx != nullptr || vy != nullptr || vz != nullptr) {
+				        // the arrays not requested are computed in a buffer
+				        std::vector<double> buffer(vx && vy && vz ? 0 : 3 * m);
+				        double* v[3] = {vx, vy, vz};
+				        for (int d = 0; d < 3; ++d)
+					        if (v[d] == nullptr) v[d] = buffer.data() + d * m;
+				        raytracing::direction_to_velocity(
+				                c._dx.data() + first, c._dy.data() + first,
+				                c._dz.data() + first, c._wavelength.data() + first, m,
+				                v[0], v[1], v[2]);
+			        }
+			        copy_out(c._time, first, m, t, h->time_scale);
+			        copy_out(c._weight, first, m, p);
+			        copy_out(c._sx, first, m, sx);
+			        copy_out(c._sy, first, m, sy);
+			        copy_out(c._sz, first, m, sz);
+		        });
+	        },
+	        -1LL);
+}
+
+//------------------------------------------------------------
+const char*
+openpmd_rays_error(void) {
+	return last_error.c_str();
+}
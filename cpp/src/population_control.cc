@@ -0,0 +1,66 @@
+#include "population_control.hh"
+#include <cmath>
+#include <stdexcept>
+///\file
+
+using raytracing::population_control;
+
+population_control::population_control():
+    _enabled(false),
+    _splitting(false),
+    _factor(1.),
+    _n_in(0),
+    _n_out(0),
+    _weight_in(0.),
+    _weight_out(0.),
+    _abs_weight_in(0.),
+    _uniform(0., 1.) {}
+
+//------------------------------------------------------------
+void
+population_control::init(unsigned long long int budget, unsigned long long int n_generated,
+                         bool splitting, unsigned long long int seed) {
+	if (budget == 0 || n_generated == 0)
+		throw std::runtime_error("Population control requires a non-zero number of rays");
+
+	// keep a margin of 3 sigma (Poisson) on the number of rays written
+	double target = budget - 3. * std::sqrt(static_cast<double>(budget));
+	if (target < 1.) target = 1.;
+
+	_enabled       = true;
+	_splitting     = splitting;
+	_factor        = target / n_generated;
+	_n_in          = 0;
+	_n_out         = 0;
+	_weight_in     = 0.;
+	_weight_out    = 0.;
+	_abs_weight_in = 0.;
+	_rng.seed(seed);
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The importance depends only on the current weight and on the rays already seen, not on the
+ * random number drawn, so the weight of the copies is unbiased.
+ */
+unsigned int
+population_control::sample(float weight, float* copy_weight) {
+	double w = std::fabs(weight);
+	++_n_in;
+	_weight_in += weight;
+	_abs_weight_in += w;
+	// zero-weight rays do not contribute to any estimate
+	if (w == 0.) return 0;
+
+	double importance = _factor * w * _n_in / _abs_weight_in;
+	if (!_splitting && importance > 1.) importance = 1.;
+
+	double n_copies = std::floor(importance);
+	if (_uniform(_rng) < importance - n_copies) n_copies += 1.;
+
+	auto copies  = static_cast<unsigned int>(n_copies);
+	*copy_weight = static_cast<float>(weight / importance);
+	_n_out += copies;
+	_weight_out += copies * (*copy_weight);
+	return copies;
+}
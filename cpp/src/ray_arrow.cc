@@ -0,0 +1,156 @@
+#include "ray_arrow.hh"
+#include <arrow/io/file.h>
+#include <arrow/ipc/api.h>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+///\file
+
+namespace {
+// Arrow type of the values of a record
+template <typename T> struct arrow_type;
+template <> struct arrow_type<float> {
+	typedef arrow::FloatType type;
+};
+template <> struct arrow_type<unsigned long long int> {
+	typedef arrow::UInt64Type type;
+};
+template <> struct arrow_type<int> {
+	typedef arrow::Int32Type type;
+};
+
+void
+check(const arrow::Status& status) {
+	if (!status.ok()) throw std::runtime_error("Arrow: " + status.ToString());
+}
+
+template <typename T>
+T
+value(arrow::Result<T> result) {
+	check(result.status());
+	return std::move(result).ValueOrDie();
+}
+} // namespace
+
+//------------------------------------------------------------
+std::shared_ptr<arrow::Schema>
+raytracing::arrow_schema(void) {
+	std::vector<std::shared_ptr<arrow::Field>> fields;
+	openPMD_io::Rays rays;
+	rays.for_each([&](field_t field, const auto& rec) {
+		typedef typename arrow_type<
+		        typename std::decay<decltype(rec)>::type::value_type>::type A;
+		fields.push_back(arrow::field(get_field_info(field).name,
+		                              arrow::TypeTraits<A>::type_singleton(), false));
+	});
+	return arrow::schema(fields);
+}
+
+//------------------------------------------------------------
+std::shared_ptr<arrow::RecordBatch>
+raytracing::to_record_batch(const openPMD_io::Rays& rays) {
+	std::vector<std::shared_ptr<arrow::Field>> fields;
+	std::vector<std::shared_ptr<arrow::Array>> columns;
+	rays.for_each([&](field_t field, const auto& rec) {
+		typedef typename std::decay<decltype(rec)>::type::value_type T;
+		typedef typename arrow_type<T>::type A;
+		if (rec.size() == 0) return; // not loaded
+		// a buffer not owning the memory of the record
+		auto buffer = std::make_shared<arrow::Buffer>(
+		        reinterpret_cast<const uint8_t*>(rec.data()), rec.size() * sizeof(T));
+		columns.push_back(std::make_shared<arrow::NumericArray<A>>(rec.size(), buffer));
+		fields.push_back(arrow::field(get_field_info(field).name,
+		                              arrow::TypeTraits<A>::type_singleton(), false));
+	});
+	return arrow::RecordBatch::Make(arrow::schema(fields), rays.size(), columns);
+}
+
+//------------------------------------------------------------
+void
+raytracing::from_record_batch(const arrow::RecordBatch& batch, openPMD_io::Rays& rays) {
+	openPMD_io::Rays defaults;
+	defaults.push(Ray());
+
+	size_t n = batch.num_rows();
+	rays.clear();
+	rays.for_each(defaults, [&](field_t field, auto& rec, const auto& def) {
+		typedef typename std::decay<decltype(rec)>::type::value_type T;
+		typedef typename arrow_type<T>::type A;
+		const char* name = get_field_info(field).name;
+
+		int index = batch.schema()->GetFieldIndex(name);
+		if (index < 0) {
+			rec.vals().assign(n, def[0]);
+			rec.set_range(def[0], def[0]);
+			return;
+		}
+		auto column = batch.column(index);
+		if (column->type_id() != A::type_id)
+			throw std::runtime_error(std::string("The column ") + name +
+			                         " of the record batch should be of type " +
+			                         arrow::TypeTraits<A>::type_singleton()->ToString());
+		if (column->null_count() != 0)
+			throw std::runtime_error(std::string("The column ") + name +
+			                         " of the record batch has null values");
+		if (n == 0) return;
+
+		const T* vals = reinterpret_cast<const T*>(
+		        std::static_pointer_cast<arrow::NumericArray<A>>(column)->raw_values());
+		T min = vals[0], max = vals[0];
+		for (size_t i = 1; i < n; ++i) {
+			if (min > vals[i]) min = vals[i];
+			if (max < vals[i]) max = vals[i];
+		}
+		rec.view(vals, n, min, max);
+	});
+	rays.size(n);
+}
+
+//------------------------------------------------------------
+void
+raytracing::write_record_batch(openPMD_io& writer, const arrow::RecordBatch& batch) {
+	openPMD_io::Rays rays;
+	from_record_batch(batch, rays);
+	writer.write_chunk(rays);
+}
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_to_arrow(const std::string& pmd_filename,
+                             const std::string& particle_species, unsigned int iter,
+                             const std::string& arrow_filename, size_t chunk_size) {
+	openPMD_io reader(pmd_filename);
+	reader.set_chunk_size(chunk_size);
+	reader.init_read(particle_species, iter);
+
+	auto sink = value(arrow::io::FileOutputStream::Open(arrow_filename));
+	// the schema is the one of the first chunk, since the projection is the same for all
+	std::shared_ptr<arrow::ipc::RecordBatchWriter> out;
+	for (auto* chunk = &reader.read_chunk(); chunk->size() != 0; chunk = &reader.read_chunk()) {
+		auto batch = to_record_batch(*chunk);
+		if (!out) out = value(arrow::ipc::MakeFileWriter(sink, batch->schema()));
+		check(out->WriteRecordBatch(*batch));
+	}
+	if (!out) out = value(arrow::ipc::MakeFileWriter(sink, arrow_schema()));
+	check(out->Close());
+	check(sink->Close());
+}
+
+//------------------------------------------------------------
+void
+raytracing::arrow_to_openPMD(const std::string& arrow_filename, const std::string& pmd_filename,
+                             const std::string& particle_species, unsigned int iter) {
+	// the batches are read from the mapped file without copying them
+	auto file = value(
+	        arrow::io::MemoryMappedFile::Open(arrow_filename, arrow::io::FileMode::READ));
+	auto reader = value(arrow::ipc::RecordBatchFileReader::Open(file));
+
+	unsigned long long int n_rays = 0;
+	for (int i = 0; i < reader->num_record_batches(); ++i)
+		n_rays += value(reader->ReadRecordBatch(i))->num_rows();
+
+	openPMD_io writer(pmd_filename);
+	writer.init_write(particle_species, n_rays, iter);
+	for (int i = 0; i < reader->num_record_batches(); ++i)
+		write_record_batch(writer, *value(reader->ReadRecordBatch(i)));
+}
@@ -0,0 +1,200 @@
+#include "ray_buffer_pool.hh"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+///\file
+
+using raytracing::buffer_pool;
+
+namespace {
+constexpr size_t kHugePageSize = size_t(1) << 21; // 2 MiB, the default on x86_64 and arm64
+
+size_t
+round_up(size_t bytes, size_t page) {
+	return (bytes + page - 1) / page * page;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+size_t
+page_size(void) {
+	static const size_t page = sysconf(_SC_PAGESIZE);
+	return page;
+}
+
+/// anonymous mapping of at least length bytes, length is set to the size mapped
+void*
+map_pages(size_t& length, raytracing::huge_pages_t huge_pages) {
+	void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+	if (huge_pages == raytracing::kHugeTLBPages) {
+		size_t huge = round_up(length, kHugePageSize);
+		p           = mmap(nullptr, huge, PROT_READ | PROT_WRITE,
+		                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED)
+			length = huge;
+		else {
+			static bool warned = false;
+			if (!warned)
+				std::cerr << "[WARNING] No huge page available (see "
+				             "/proc/sys/vm/nr_hugepages), using regular pages"
+				          << std::endl;
+			warned = true;
+		}
+	}
+#endif
+	if (p == MAP_FAILED) {
+		p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+		if (huge_pages == raytracing::kTransparentHugePages) madvise(p, length, MADV_HUGEPAGE);
+#endif
+	}
+	return p;
+}
+
+void
+unmap_pages(void* p, size_t length) noexcept {
+	munmap(p, length);
+}
+#else
+size_t
+page_size(void) {
+	return 4096;
+}
+
+/// heap fallback: the buffer is aligned by hand, the address allocated is stored just before it
+void*
+map_pages(size_t& length, raytracing::huge_pages_t) {
+	char* raw = static_cast<char*>(::operator new(length + page_size()));
+	void* p   = reinterpret_cast<void*>(
+                round_up(reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*), page_size()));
+	static_cast<void**>(p)[-1] = raw;
+	return p;
+}
+
+void
+unmap_pages(void* p, size_t) noexcept {
+	::operator delete(static_cast<void**>(p)[-1]);
+}
+#endif
+} // namespace
+
+constexpr size_t buffer_pool::kMinPooled;
+
+//------------------------------------------------------------
+buffer_pool&
+buffer_pool::instance(void) {
+	// never destroyed: buffers can be released by static objects after the end of main()
+	static buffer_pool* pool = new buffer_pool();
+	return *pool;
+}
+
+//------------------------------------------------------------
+void
+buffer_pool::set_options(const buffer_pool_options& options) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_options = options;
+}
+
+raytracing::buffer_pool_options
+buffer_pool::options(void) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _options;
+}
+
+//------------------------------------------------------------
+void*
+buffer_pool::acquire(size_t bytes) {
+	std::lock_guard<std::mutex> lock(_mutex);
+
+	size_t length = round_up(bytes, page_size());
+	// the smallest released buffer large enough, if not more than twice too large
+	auto it = _free.lower_bound(length);
+	void* p = nullptr;
+	if (it != _free.end() && it->first / 2 <= length) {
+		p      = it->second;
+		length = it->first;
+		_cached -= length;
+		_free.erase(it);
+		++_n_reused;
+	} else {
+		p = map_pages(length, _options.huge_pages);
+		_mapped += length;
+		++_n_mapped;
+	}
+	_used.emplace(p, length);
+	_peak = std::max(_peak, _mapped - _cached);
+	return p;
+}
+
+//------------------------------------------------------------
+void
+buffer_pool::release(void* p, size_t) noexcept {
+	std::lock_guard<std::mutex> lock(_mutex);
+	auto it = _used.find(p);
+	if (it == _used.end()) return;
+	size_t length = it->second;
+	_used.erase(it);
+
+	size_t max_cached = _options.max_cached != 0 ? _options.max_cached : _peak;
+	// the largest released buffers are unmapped first when the cache is full
+	while (_cached + length > max_cached && !_free.empty()) {
+		auto largest = std::prev(_free.end());
+		_cached -= largest->first;
+		unmap(largest->second, largest->first);
+		_free.erase(largest);
+	}
+	if (_cached + length > max_cached) {
+		unmap(p, length);
+		return;
+	}
+	_free.emplace(length, p);
+	_cached += length;
+}
+
+//------------------------------------------------------------
+void
+buffer_pool::trim(void) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (auto& f : _free)
+		unmap(f.second, f.first);
+	_free.clear();
+	_cached = 0;
+	_peak   = _mapped;
+}
+
+void
+buffer_pool::unmap(void* p, size_t length) noexcept {
+	unmap_pages(p, length);
+	_mapped -= length;
+}
+
+//------------------------------------------------------------
+size_t
+buffer_pool::cached_bytes(void) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _cached;
+}
+
+size_t
+buffer_pool::mapped_bytes(void) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _mapped;
+}
+
+unsigned long long int
+buffer_pool::n_mapped(void) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _n_mapped;
+}
+
+unsigned long long int
+buffer_pool::n_reused(void) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _n_reused;
+}
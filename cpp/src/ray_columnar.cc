@@ -0,0 +1,201 @@
+#include "ray_columnar.hh"
+#include "openPMD_io.hh"
+#include <fstream>
+#include <stdexcept>
+#include <type_traits>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+///\file
+
+using raytracing::columnar_file;
+
+namespace {
+const char kMagic[8] = "RAYCOLS";
+
+std::uint64_t
+align(std::uint64_t pos) {
+	return (pos + columnar_file::kAlignment - 1) / columnar_file::kAlignment *
+	       columnar_file::kAlignment;
+}
+} // namespace
+
+constexpr std::uint64_t columnar_file::kAlignment;
+constexpr std::uint32_t columnar_file::kVersion;
+constexpr std::uint32_t columnar_file::kByteOrder;
+
+//------------------------------------------------------------
+bool
+columnar_file::is_columnar(const std::string& filename) {
+	char magic[sizeof(kMagic)] = {0};
+	std::ifstream f(filename, std::ios::binary);
+	if (!f.read(magic, sizeof(magic))) return false;
+	return std::memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+//------------------------------------------------------------
+columnar_file::columnar_file(const std::string& filename):
+    _filename(filename), _fd(-1), _size(0), _data(nullptr), _header(nullptr) {
+	_fd = open(filename.c_str(), O_RDONLY);
+	if (_fd < 0) throw std::runtime_error("Cannot open file " + filename);
+	struct stat st;
+	if (fstat(_fd, &st) != 0) {
+		close(_fd);
+		throw std::runtime_error("Cannot get the size of file " + filename);
+	}
+	if (static_cast<size_t>(st.st_size) < sizeof(header_t)) {
+		close(_fd);
+		throw std::runtime_error("File too small for a ray columnar file: " + filename);
+	}
+	map(st.st_size, false);
+
+	// the destructor is not called if the constructor throws
+	auto fail = [this](const std::string& msg) {
+		munmap(_data, _size);
+		close(_fd);
+		throw std::runtime_error(msg + _filename);
+	};
+	if (std::memcmp(_header->magic, kMagic, sizeof(kMagic)) != 0 ||
+	    _header->version != kVersion || _header->n_fields != kNFields)
+		fail("Not a compatible ray columnar file: ");
+	if (_header->byte_order != kByteOrder)
+		fail("Ray columnar file written with a different byte order: ");
+	for (unsigned int f = 0; f < kNFields; ++f)
+		if (_header->offset[f] + _header->n_rays * get_field_info(field_t(f)).size > _size)
+			fail("Truncated ray columnar file: ");
+	// the columns are read sequentially
+	madvise(_data, _size, MADV_SEQUENTIAL);
+}
+
+//------------------------------------------------------------
+columnar_file::columnar_file(const std::string& filename, const std::string& particle_species,
+                             unsigned int iter, std::uint64_t n_rays):
+    _filename(filename), _fd(-1), _size(0), _data(nullptr), _header(nullptr) {
+	header_t header;
+	std::memset(&header, 0, sizeof(header));
+	if (particle_species.size() >= sizeof(header.particle_species))
+		throw std::runtime_error("Particle species name too long: " + particle_species);
+
+	std::memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version    = kVersion;
+	header.byte_order = kByteOrder;
+	header.n_fields   = kNFields;
+	header.iteration  = iter;
+	header.n_rays     = n_rays;
+	std::strncpy(header.particle_species, particle_species.c_str(),
+	             sizeof(header.particle_species) - 1);
+	std::uint64_t pos = align(sizeof(header_t));
+	for (unsigned int f = 0; f < kNFields; ++f) {
+		header.offset[f] = pos;
+		pos              = align(pos + n_rays * get_field_info(field_t(f)).size);
+	}
+
+	_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (_fd < 0) throw std::runtime_error("Cannot create file " + filename);
+	if (ftruncate(_fd, pos) != 0) {
+		close(_fd);
+		throw std::runtime_error("Cannot allocate file " + filename);
+	}
+	map(pos, true);
+	std::memcpy(_header, &header, sizeof(header));
+}
+
+//------------------------------------------------------------
+void
+columnar_file::map(size_t size, bool writable) {
+	_size   = size;
+	void* p = mmap(nullptr, _size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+	               _fd, 0);
+	if (p == MAP_FAILED) {
+		close(_fd);
+		throw std::runtime_error("Cannot map file " + _filename);
+	}
+	_data   = static_cast<unsigned char*>(p);
+	_header = reinterpret_cast<header_t*>(_data);
+}
+
+//------------------------------------------------------------
+columnar_file::~columnar_file() {
+	if (_data != nullptr) munmap(_data, _size);
+	if (_fd >= 0) close(_fd);
+}
+
+#else
+//------------------------------------------------------------
+// the format relies on memory mapped files
+columnar_file::columnar_file(const std::string& filename):
+    _filename(filename), _fd(-1), _size(0), _data(nullptr), _header(nullptr) {
+	map(0, false);
+}
+
+columnar_file::columnar_file(const std::string& filename, const std::string&, unsigned int,
+                             std::uint64_t):
+    _filename(filename), _fd(-1), _size(0), _data(nullptr), _header(nullptr) {
+	map(0, true);
+}
+
+void
+columnar_file::map(size_t, bool) {
+	throw std::runtime_error("Ray columnar files are not available on this system: " +
+	                         _filename);
+}
+
+columnar_file::~columnar_file() {}
+#endif
+
+//------------------------------------------------------------
+void
+raytracing::openPMD_to_columnar(const std::string& pmd_filename,
+                                const std::string& particle_species, unsigned int iter,
+                                const std::string& columnar_filename, size_t chunk_size) {
+	openPMD_io reader(pmd_filename);
+	reader.set_chunk_size(chunk_size);
+	auto n_rays = reader.init_read(particle_species, iter);
+
+	columnar_file out(columnar_filename, particle_species, iter, n_rays);
+	float x, y, z;
+	reader.get_gravity_direction(&x, &y, &z);
+	out.set_gravity_direction(x, y, z);
+
+	// the min-max values are computed while copying since they are not read from file
+	openPMD_io::Rays ranges;
+	size_t offset = 0;
+	for (auto* chunk = &reader.read_chunk(); chunk->size() != 0; chunk = &reader.read_chunk()) {
+		ranges.for_each(*chunk, [&](field_t field, auto& range, const auto& rec) {
+			typedef typename std::decay<decltype(rec)>::type::value_type T;
+			T* col = out.column<T>(field) + offset;
+			std::memcpy(col, rec.data(), rec.size() * sizeof(T));
+			for (size_t i = 0; i < rec.size(); ++i)
+				range.update_range(col[i], col[i]);
+		});
+		offset += chunk->size();
+	}
+	ranges.for_each([&](field_t field, const auto& range) {
+		out.set_range(field, range.min(), range.max());
+	});
+}
+
+//------------------------------------------------------------
+void
+raytracing::columnar_to_openPMD(const std::string& columnar_filename,
+                                const std::string& pmd_filename) {
+	columnar_file in(columnar_filename);
+	const auto& header = in.header();
+
+	openPMD_io writer(pmd_filename);
+	writer.init_write(in.particle_species(), header.n_rays, header.iteration);
+	writer.set_gravity_direction(header.gravity[0], header.gravity[1], header.gravity[2]);
+
+	// the whole file is written at once directly from the mapped memory
+	openPMD_io::Rays chunk;
+	chunk.for_each([&](field_t field, auto& rec) {
+		typedef typename std::decay<decltype(rec)>::type::value_type T;
+		rec.view(in.column<T>(field), header.n_rays, in.min<T>(field), in.max<T>(field));
+	});
+	chunk.size(header.n_rays);
+	writer.write_chunk(chunk);
+}
@@ -0,0 +1,149 @@
+#include "ray_merge.hh"
+#include "openPMD_io.hh"
+#include "ray_threads.hh"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+///\file
+
+using raytracing::openPMD_io;
+
+namespace {
+/// number of chunks read ahead for each file
+constexpr size_t kQueueDepth = 2;
+
+/// chunks read from one input file, waiting to be written
+struct file_queue {
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::deque<openPMD_io::Rays> chunks;
+	bool done = false;
+	std::exception_ptr error;
+};
+} // namespace
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The readers take the files in the order of the list, so the file being written is always
+ * being read or already read: the bounded queues cannot deadlock.
+ */
+unsigned long long int
+raytracing::merge_files(const std::vector<std::string>& inputs, const std::string& output,
+                        const std::string& particle_species, unsigned int iter,
+                        const merge_options& options) {
+	if (inputs.empty()) throw std::runtime_error("No input file to be merged");
+
+	// the output datasets are declared once for all the rays
+	unsigned long long int total = 0;
+	float gravity[3]             = {0, 0, 0};
+	for (size_t f = 0; f < inputs.size(); ++f) {
+		openPMD_io reader(inputs[f]);
+		total += reader.init_read(particle_species, iter);
+		if (f == 0) reader.get_gravity_direction(&gravity[0], &gravity[1], &gravity[2]);
+	}
+
+	openPMD_io writer(output, "openpmd-ray-merge");
+	writer.set_chunk_size(options.chunk_size);
+	writer.init_write(particle_species, total, iter);
+	writer.set_gravity_direction(gravity[0], gravity[1], gravity[2]);
+
+	unsigned long long int written = 0;
+	openPMD_io::Rays renumbered;
+	auto write = [&](const openPMD_io::Rays& chunk) {
+		if (options.renumber_id) {
+			renumbered.copy(chunk);
+			renumbered._id.clear();
+			for (size_t i = 0; i < chunk.size(); ++i)
+				renumbered._id.push_back(written + i);
+			writer.write_chunk(renumbered);
+		} else
+			writer.write_chunk(chunk);
+		written += chunk.size();
+	};
+
+	std::vector<std::string> files(inputs);
+	files.push_back(output);
+	unsigned int n_threads =
+	        std::min<unsigned int>(io_threads(files, options.n_threads), inputs.size());
+	if (n_threads <= 1) {
+		for (const auto& input : inputs) {
+			openPMD_io reader(input);
+			reader.set_chunk_size(options.chunk_size);
+			reader.init_read(particle_species, iter);
+			for (auto* chunk = &reader.read_chunk(); chunk->size() != 0;
+			     chunk       = &reader.read_chunk())
+				write(*chunk);
+		}
+		return written;
+	}
+
+	std::vector<file_queue> queues(inputs.size());
+	std::atomic<size_t> next_file(0);
+	std::atomic<bool> abort(false);
+	auto read = [&]() {
+		for (size_t f = next_file++; f < inputs.size() && !abort; f = next_file++) {
+			file_queue& q = queues[f];
+			try {
+				openPMD_io reader(inputs[f]);
+				reader.set_chunk_size(options.chunk_size);
+				reader.init_read(particle_species, iter);
+				for (auto* chunk = &reader.read_chunk(); chunk->size() != 0;
+				     chunk       = &reader.read_chunk()) {
+					openPMD_io::Rays copy;
+					copy.copy(*chunk);
+					std::unique_lock<std::mutex> lock(q.mutex);
+					q.cv.wait(lock,
+					          [&] { return q.chunks.size() < kQueueDepth || abort; });
+					if (abort) break;
+					q.chunks.push_back(std::move(copy));
+					q.cv.notify_all();
+				}
+			} catch (...) {
+				q.error = std::current_exception();
+			}
+			std::lock_guard<std::mutex> lock(q.mutex);
+			q.done = true;
+			q.cv.notify_all();
+		}
+	};
+	std::vector<std::thread> readers;
+	for (unsigned int t = 0; t < n_threads; ++t)
+		readers.emplace_back(read);
+
+	std::exception_ptr error;
+	try {
+		for (auto& q : queues) {
+			while (true) {
+				openPMD_io::Rays chunk;
+				{
+					std::unique_lock<std::mutex> lock(q.mutex);
+					q.cv.wait(lock, [&] { return !q.chunks.empty() || q.done; });
+					if (q.chunks.empty()) {
+						if (q.error) std::rethrow_exception(q.error);
+						break;
+					}
+					chunk = std::move(q.chunks.front());
+					q.chunks.pop_front();
+					q.cv.notify_all();
+				}
+				write(chunk);
+			}
+		}
+	} catch (...) {
+		error = std::current_exception();
+		abort = true;
+		for (auto& q : queues) {
+			std::lock_guard<std::mutex> lock(q.mutex);
+			q.cv.notify_all();
+		}
+	}
+	for (auto& t : readers)
+		t.join();
+	if (error) std::rethrow_exception(error);
+	return written;
+}
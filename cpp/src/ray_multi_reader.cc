@@ -0,0 +1,141 @@
+#include "ray_multi_reader.hh"
+#include "ray_threads.hh"
+#include <algorithm>
+#include <stdexcept>
+///\file
+
+using raytracing::multi_reader;
+using raytracing::openPMD_io;
+
+//------------------------------------------------------------
+multi_reader::stream::stream(multi_reader& owner, const read_request& request):
+    _owner(owner), _request(request), _reader(new openPMD_io(owner._name)), _n_rays(0) {
+	_reader->set_chunk_size(owner._options.chunk_size);
+	_n_rays = _reader->init_read(request.particle_species, request.iter, request.n_rays);
+}
+
+//------------------------------------------------------------
+bool
+multi_reader::stream::wait_chunk(std::unique_lock<std::mutex>& lock) {
+	_owner._data.wait(lock, [this] { return !_queue.empty() || _done; });
+	if (!_queue.empty()) return true;
+	if (_error) std::rethrow_exception(_error);
+	return false;
+}
+
+//------------------------------------------------------------
+const openPMD_io::Rays&
+multi_reader::stream::read_chunk(void) {
+	std::unique_lock<std::mutex> lock(_owner._mutex);
+	// without reading threads, the chunk is read on demand, one stream at a time
+	if (_owner._threads.empty()) return _reader->read_chunk();
+	if (!wait_chunk(lock)) {
+		_current.clear();
+		return _current;
+	}
+	_current = std::move(_queue.front());
+	_queue.pop_front();
+	_owner._space.notify_all();
+	return _current;
+}
+
+//------------------------------------------------------------
+raytracing::Ray
+multi_reader::stream::trace_read(void) {
+	if (_owner._threads.empty()) {
+		std::lock_guard<std::mutex> lock(_owner._mutex);
+		if (_reader->is_read_finished())
+			throw std::runtime_error("All the rays of the stream have been read");
+		return _reader->trace_read();
+	}
+	if (_current.is_chunk_finished() && read_chunk().size() == 0)
+		throw std::runtime_error("All the rays of the stream have been read");
+	return _current.pop();
+}
+
+//------------------------------------------------------------
+bool
+multi_reader::stream::is_read_finished(void) {
+	if (_owner._threads.empty()) {
+		std::lock_guard<std::mutex> lock(_owner._mutex);
+		return _reader->is_read_finished();
+	}
+	if (!_current.is_chunk_finished()) return false;
+	std::unique_lock<std::mutex> lock(_owner._mutex);
+	return !wait_chunk(lock);
+}
+
+//------------------------------------------------------------
+multi_reader::multi_reader(const std::string& filename, const std::vector<read_request>& requests,
+                           const multi_reader_options& options):
+    _name(filename), _options(options) {
+	if (_options.depth == 0) _options.depth = 1;
+	// the streams are opened sequentially, only the requested iterations are parsed
+	for (const auto& request : requests)
+		_streams.emplace_back(new stream(*this, request));
+
+	_options.n_threads = std::min<size_t>(io_threads({filename}, _options.n_threads),
+	                                      std::max<size_t>(_streams.size(), 1));
+	if (_options.n_threads == 1) return; // the streams are read by the threads consuming them
+	for (unsigned int t = 0; t < _options.n_threads; ++t)
+		_threads.emplace_back(&multi_reader::work, this, t);
+}
+
+//------------------------------------------------------------
+multi_reader::~multi_reader() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_space.notify_all();
+	for (auto& t : _threads)
+		t.join();
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The chunks are read without holding the lock. Each stream is served by a single thread, so
+ * its openPMD_io reader is never used concurrently.
+ */
+void
+multi_reader::work(unsigned int t) {
+	size_t n_threads = _options.n_threads;
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (!_stop) {
+		stream* next  = nullptr;
+		bool all_done = true;
+		for (size_t k = t; k < _streams.size(); k += n_threads) {
+			stream& s = *_streams[k];
+			all_done &= s._done;
+			if (!s._done && s._queue.size() < _options.depth) {
+				next = &s;
+				break;
+			}
+		}
+		if (all_done) return;
+		if (next == nullptr) { // all the queues are full
+			_space.wait(lock);
+			continue;
+		}
+
+		lock.unlock();
+		openPMD_io::Rays chunk;
+		bool last = false;
+		std::exception_ptr error;
+		try {
+			const auto& read = next->_reader->read_chunk();
+			last             = read.size() == 0;
+			if (!last) chunk.copy(read); // the chunk read may be a view
+		} catch (...) {
+			error = std::current_exception();
+			last  = true;
+		}
+		lock.lock();
+		if (last) {
+			next->_done  = true;
+			next->_error = error;
+		} else
+			next->_queue.push_back(std::move(chunk));
+		_data.notify_all();
+	}
+}
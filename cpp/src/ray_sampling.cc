@@ -0,0 +1,85 @@
+#include "ray_sampling.hh"
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_set>
+///\file
+
+//------------------------------------------------------------
+std::vector<std::uint64_t>
+raytracing::sample_uniform(std::uint64_t n, std::uint64_t k, std::mt19937_64& rng) {
+	if (k > n) throw std::runtime_error("Cannot sample more rays than available");
+	std::vector<std::uint64_t> indices;
+	indices.reserve(k);
+	if (2 * k > n) {
+		// dense sampling: selection sampling is cheaper than a hash set
+		std::uniform_real_distribution<double> uniform(0., 1.);
+		for (std::uint64_t i = 0; i < n && indices.size() < k; ++i)
+			if (uniform(rng) * (n - i) < k - indices.size()) indices.push_back(i);
+		return indices;
+	}
+
+	std::unordered_set<std::uint64_t> selected;
+	selected.reserve(k);
+	for (std::uint64_t j = n - k; j < n; ++j) {
+		std::uint64_t t = std::uniform_int_distribution<std::uint64_t>(0, j)(rng);
+		if (!selected.insert(t).second) selected.insert(j);
+	}
+	indices.assign(selected.begin(), selected.end());
+	std::sort(indices.begin(), indices.end());
+	return indices;
+}
+
+//------------------------------------------------------------
+std::vector<std::uint64_t>
+raytracing::sample_stratified(std::uint64_t n, std::uint64_t k, std::mt19937_64& rng) {
+	if (k > n) throw std::runtime_error("Cannot sample more rays than available");
+	std::vector<std::uint64_t> indices;
+	indices.reserve(k);
+	for (std::uint64_t s = 0; s < k; ++s) {
+		// the strata differ at most by one ray
+		std::uint64_t begin = s * n / k, end = (s + 1) * n / k;
+		indices.push_back(std::uniform_int_distribution<std::uint64_t>(begin, end - 1)(rng));
+	}
+	return indices;
+}
+
+//------------------------------------------------------------
+raytracing::alias_table::alias_table(const std::vector<double>& weights):
+    _prob(weights.size()), _alias(weights.size()), _total(0.) {
+	for (auto w : weights) {
+		if (w < 0.) throw std::runtime_error("Negative weights cannot be sampled");
+		_total += w;
+	}
+	if (weights.empty() || _total <= 0.)
+		throw std::runtime_error("Cannot sample from weights summing to zero");
+
+	// probabilities scaled to a mean of 1, split in those below and above the mean
+	std::vector<std::uint64_t> small, large;
+	double scale = weights.size() / _total;
+	for (std::uint64_t i = 0; i < weights.size(); ++i) {
+		_prob[i] = weights[i] * scale;
+		(_prob[i] < 1. ? small : large).push_back(i);
+	}
+	while (!small.empty() && !large.empty()) {
+		std::uint64_t s = small.back(), l = large.back();
+		small.pop_back();
+		_alias[s] = l;
+		_prob[l] -= 1. - _prob[s];
+		if (_prob[l] < 1.) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// what is left is 1 up to rounding errors
+	for (auto i : large)
+		_prob[i] = 1.;
+	for (auto i : small)
+		_prob[i] = 1.;
+}
+
+//------------------------------------------------------------
+std::uint64_t
+raytracing::alias_table::draw(std::mt19937_64& rng) const {
+	std::uint64_t i = std::uniform_int_distribution<std::uint64_t>(0, _prob.size() - 1)(rng);
+	return std::uniform_real_distribution<double>(0., 1.)(rng) < _prob[i] ? i : _alias[i];
+}
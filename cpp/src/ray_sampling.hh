@@ -0,0 +1,43 @@
+#ifndef RAY_SAMPLING_HH
+#define RAY_SAMPLING_HH
+///\file
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace raytracing {
+
+/** \brief k distinct indices uniformly drawn out of n, in increasing order
+ *
+ * Floyd's algorithm: the memory and time depend only on k, not on n.
+ */
+std::vector<std::uint64_t> sample_uniform(std::uint64_t n, std::uint64_t k, std::mt19937_64& rng);
+
+/** \brief one index uniformly drawn in each of k strata of equal size, in increasing order
+ */
+std::vector<std::uint64_t> sample_stratified(std::uint64_t n, std::uint64_t k,
+                                             std::mt19937_64& rng);
+
+/** \class alias_table
+ * \brief Vose's alias method: draws indices with a probability proportional to their weight
+ * in constant time
+ */
+class alias_table {
+public:
+	/// \brief builds the table in linear time, the weights must be non-negative
+	explicit alias_table(const std::vector<double>& weights);
+
+	/// \brief draws an index with a probability proportional to its weight
+	std::uint64_t draw(std::mt19937_64& rng) const;
+
+	double total(void) const { return _total; } ///< sum of the weights
+	size_t size(void) const { return _prob.size(); }
+
+private:
+	std::vector<double> _prob;
+	std::vector<std::uint64_t> _alias;
+	double _total;
+};
+
+} // namespace raytracing
+#endif
@@ -0,0 +1,111 @@
+#include "ray_session.hh"
+#include <iostream>
+#include <stdexcept>
+///\file
+
+using raytracing::openPMD_io;
+using raytracing::ray_session;
+
+ray_session::ray_session(const std::string& filename, const std::string& mc_code_name,
+                         const std::string& instrument_name):
+    _filename(filename),
+    _mc_code_name(mc_code_name),
+    _instrument_name(instrument_name),
+    _chunk_size(0) {}
+
+ray_session::~ray_session() {
+	try {
+		close();
+	} catch (std::exception& e) {
+		std::cerr << "[ERROR] Cannot close the session: " << e.what() << std::endl;
+	}
+}
+
+//------------------------------------------------------------
+void
+ray_session::set_backend_config(const backend_config& config) {
+	if (_series)
+		throw std::runtime_error("The backend options must be set before adding a component");
+	_backend = config;
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The series is created with the first component, with the options of its writer.
+ */
+openPMD_io&
+ray_session::add_component(const std::string& name, const std::string& particle_species,
+                           unsigned long long int n_rays) {
+	if (_iterations.count(name) != 0)
+		throw std::runtime_error("Component " + name + " already in the session");
+
+	std::unique_ptr<openPMD_io> writer(
+	        new openPMD_io(_filename, _mc_code_name, "", _instrument_name, name));
+	writer->set_backend_config(_backend);
+	if (_chunk_size != 0) writer->set_chunk_size(_chunk_size);
+	if (!_series) {
+		_series = std::make_shared<openPMD::Series>(_filename, openPMD::Access::CREATE,
+		                                            writer->series_options(true));
+		_series->setAuthor("openPMD raytracing API");
+	}
+
+	unsigned int iter = _writers.size() + 1;
+	writer->init_component(_series, this, name, particle_species, n_rays, iter);
+	_series->flush();
+	_iterations[name] = iter;
+	_writers.push_back(std::move(writer));
+	return *_writers.back();
+}
+
+//------------------------------------------------------------
+openPMD_io&
+ray_session::component(const std::string& name) {
+	return *_writers.at(iteration(name) - 1);
+}
+
+unsigned int
+ray_session::iteration(const std::string& name) const {
+	auto it = _iterations.find(name);
+	if (it == _iterations.end())
+		throw std::runtime_error("Component " + name + " not in the session");
+	return it->second;
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * numParticles is updated only once the rays of all the writers are flushed, as in
+ * openPMD_io::end_flush().
+ */
+void
+ray_session::flush(void) {
+	bool pending = false;
+	for (auto& writer : _writers)
+		pending |= writer->queue_pending();
+	if (!pending) return;
+
+	_series->flush();
+	for (auto& writer : _writers)
+		writer->commit_pending();
+	_series->flush();
+}
+
+//------------------------------------------------------------
+void
+ray_session::close(void) {
+	if (!_series) return;
+	flush();
+	for (auto& writer : _writers)
+		writer->close_write(); // summary attributes, and index through add_index()
+	_series->setAttribute("rayIndex", _index);
+	_series->flush();
+
+	_writers.clear();
+	_iterations.clear();
+	_index.clear();
+	_series.reset();
+}
+
+void
+ray_session::add_index(const std::vector<std::string>& index) {
+	_index.insert(_index.end(), index.begin(), index.end());
+}
@@ -0,0 +1,161 @@
+#include "ray_shard.hh"
+#include "openPMD_io.hh"
+#include "ray_threads.hh"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+///\file
+
+using raytracing::openPMD_io;
+using raytracing::shard_info;
+
+namespace {
+//------------------------------------------------------------
+// first ray of each shard with the same total weight, the last element is n_rays
+std::vector<unsigned long long int>
+weight_boundaries(const std::string& input, const std::string& particle_species,
+                  unsigned int iter, unsigned int n_shards, size_t chunk_size,
+                  unsigned long long int n_rays) {
+	// first pass: weight of each chunk
+	std::vector<unsigned long long int> starts;
+	std::vector<double> cumulative = {0.};
+	{
+		openPMD_io reader(input);
+		reader.set_chunk_size(chunk_size);
+		reader.set_projection(raytracing::field_bit(raytracing::kWeight));
+		reader.init_read(particle_species, iter);
+		unsigned long long int start = 0;
+		for (auto* chunk = &reader.read_chunk(); chunk->size() != 0;
+		     chunk       = &reader.read_chunk()) {
+			double sum = 0;
+			for (size_t i = 0; i < chunk->size(); ++i)
+				sum += chunk->_weight[i];
+			starts.push_back(start);
+			cumulative.push_back(cumulative.back() + sum);
+			start += chunk->size();
+		}
+		starts.push_back(start);
+	}
+
+	std::vector<unsigned long long int> boundaries = {0};
+	double total                                   = cumulative.back();
+	if (total <= 0.) { // nothing to balance
+		for (unsigned int k = 1; k <= n_shards; ++k)
+			boundaries.push_back(k * n_rays / n_shards);
+		return boundaries;
+	}
+
+	// the boundary is found within the chunk reaching the target weight
+	openPMD_io reader(input);
+	reader.set_chunk_size(chunk_size);
+	reader.set_projection(raytracing::field_bit(raytracing::kWeight));
+	reader.init_read(particle_species, iter);
+	for (unsigned int k = 1; k < n_shards; ++k) {
+		double target = total * k / n_shards;
+		size_t c      = std::lower_bound(cumulative.begin() + 1, cumulative.end(), target) -
+		           cumulative.begin() - 1;
+		if (c + 1 >= starts.size()) c = starts.size() - 2;
+		reader.seek(starts[c]);
+		const auto& chunk = reader.read_chunk();
+		double sum        = cumulative[c];
+		size_t i          = 0;
+		while (i < chunk.size() && sum < target)
+			sum += chunk._weight[i++];
+		boundaries.push_back(std::max(boundaries.back(), starts[c] + i));
+	}
+	boundaries.push_back(n_rays);
+	return boundaries;
+}
+} // namespace
+
+//------------------------------------------------------------
+std::string
+raytracing::shard_filename(const std::string& output, unsigned int shard) {
+	size_t dot   = output.find_last_of('.');
+	size_t slash = output.find_last_of('/');
+	if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+		return output + "_" + std::to_string(shard);
+	return output.substr(0, dot) + "_" + std::to_string(shard) + output.substr(dot);
+}
+
+//------------------------------------------------------------
+std::vector<shard_info>
+raytracing::split_file(const std::string& input, const std::string& output,
+                       const std::string& particle_species, unsigned int n_shards,
+                       unsigned int iter, const shard_options& options) {
+	if (n_shards == 0) throw std::runtime_error("At least one shard is required");
+
+	unsigned long long int n_rays;
+	float gravity[3];
+	{
+		openPMD_io reader(input);
+		n_rays = reader.init_read(particle_species, iter);
+		reader.get_gravity_direction(&gravity[0], &gravity[1], &gravity[2]);
+	}
+
+	std::vector<unsigned long long int> boundaries;
+	if (options.balance == kBalanceWeight)
+		boundaries = weight_boundaries(input, particle_species, iter, n_shards,
+		                               options.chunk_size, n_rays);
+	else
+		for (unsigned int k = 0; k <= n_shards; ++k)
+			boundaries.push_back(k * n_rays / n_shards);
+
+	std::vector<shard_info> shards(n_shards);
+	std::vector<std::exception_ptr> errors(n_shards);
+	std::atomic<unsigned int> next_shard(0);
+	auto write = [&]() {
+		for (unsigned int k = next_shard++; k < n_shards; k = next_shard++) {
+			shard_info& shard = shards[k];
+			shard.filename    = shard_filename(output, k);
+			shard.first       = boundaries[k];
+			shard.last        = boundaries[k + 1];
+			shard.weight      = 0;
+			try {
+				openPMD_io writer(shard.filename, "openpmd-ray-shard");
+				writer.set_chunk_size(options.chunk_size);
+				// the datasets cannot be empty
+				writer.init_write(particle_species,
+				                  std::max(1ull, shard.last - shard.first), iter);
+				writer.set_gravity_direction(gravity[0], gravity[1], gravity[2]);
+				writer.set_attribute("shardSource", input);
+				writer.set_attribute("shardIndex", k);
+				writer.set_attribute("shardCount", n_shards);
+				writer.set_attribute("shardFirstRay", shard.first);
+				writer.set_attribute("shardLastRay", shard.last);
+				if (shard.last == shard.first) continue; // n_rays=0 would read all
+
+				openPMD_io reader(input);
+				reader.set_chunk_size(options.chunk_size);
+				reader.init_read(particle_species, iter, shard.last);
+				reader.seek(shard.first);
+				for (auto* chunk = &reader.read_chunk(); chunk->size() != 0;
+				     chunk       = &reader.read_chunk()) {
+					for (size_t i = 0; i < chunk->size(); ++i)
+						shard.weight += chunk->_weight[i];
+					writer.write_chunk(*chunk);
+				}
+			} catch (...) {
+				errors[k] = std::current_exception();
+			}
+		}
+	};
+	std::vector<std::string> files = {input};
+	for (unsigned int k = 0; k < n_shards; ++k)
+		files.push_back(shard_filename(output, k));
+	unsigned int n_threads = std::min(io_threads(files, options.n_threads), n_shards);
+	if (n_threads <= 1)
+		write();
+	else {
+		std::vector<std::thread> writers;
+		for (unsigned int t = 0; t < n_threads; ++t)
+			writers.emplace_back(write);
+		for (auto& t : writers)
+			t.join();
+	}
+	for (auto& e : errors)
+		if (e) std::rethrow_exception(e);
+	return shards;
+}
@@ -0,0 +1,111 @@
+#include "ray_sort.hh"
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+///\file
+
+namespace {
+// spreads the 32 bits of v on the even bits of the result
+std::uint64_t
+spread_bits(std::uint64_t v) {
+	v = (v | (v << 16)) & 0x0000FFFF0000FFFFull;
+	v = (v | (v << 8)) & 0x00FF00FF00FF00FFull;
+	v = (v | (v << 4)) & 0x0F0F0F0F0F0F0F0Full;
+	v = (v | (v << 2)) & 0x3333333333333333ull;
+	v = (v | (v << 1)) & 0x5555555555555555ull;
+	return v;
+}
+
+// maps [min, max] on [0, 2^32-1]
+std::uint64_t
+quantize(float v, float min, float max) {
+	if (max <= min) return 0;
+	return static_cast<std::uint64_t>((double(v) - min) / (double(max) - min) * 4294967295.);
+}
+
+// unsigned integer with the same order as the float
+std::uint64_t
+float_key(float v) {
+	std::uint32_t bits;
+	std::memcpy(&bits, &v, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+} // namespace
+
+//------------------------------------------------------------
+const char*
+raytracing::sort_key_name(sort_key_t key) {
+	switch (key) {
+	case kSortMorton:
+		return "mortonXY";
+	case kSortWavelength:
+		return "wavelength";
+	case kSortTime:
+		return "rayTime";
+	default:
+		return "none";
+	}
+}
+
+//------------------------------------------------------------
+std::vector<raytracing::field_t>
+raytracing::sort_fields(sort_key_t key) {
+	switch (key) {
+	case kSortMorton:
+		return {kX, kY};
+	case kSortWavelength:
+		return {kWavelength};
+	case kSortTime:
+		return {kTime};
+	default:
+		return {};
+	}
+}
+
+//------------------------------------------------------------
+std::vector<std::uint32_t>
+raytracing::sort_permutation(const openPMD_io::Rays& chunk, sort_key_t key) {
+	size_t n = chunk.size();
+	std::vector<std::uint64_t> keys(n);
+	switch (key) {
+	case kSortMorton: {
+		const auto& x = chunk._x;
+		const auto& y = chunk._y;
+		auto x_range  = std::minmax_element(x.data(), x.data() + n);
+		auto y_range  = std::minmax_element(y.data(), y.data() + n);
+		for (size_t i = 0; i < n; ++i)
+			keys[i] = spread_bits(quantize(x[i], *x_range.first, *x_range.second)) |
+			          (spread_bits(quantize(y[i], *y_range.first, *y_range.second)) << 1);
+		break;
+	}
+	case kSortWavelength:
+		for (size_t i = 0; i < n; ++i)
+			keys[i] = float_key(chunk._wavelength[i]);
+		break;
+	case kSortTime:
+		for (size_t i = 0; i < n; ++i)
+			keys[i] = float_key(chunk._time[i]);
+		break;
+	default:
+		break;
+	}
+
+	std::vector<std::uint32_t> order(n);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(),
+	                 [&keys](std::uint32_t a, std::uint32_t b) { return keys[a] < keys[b]; });
+	return order;
+}
+
+//------------------------------------------------------------
+void
+raytracing::permute(const openPMD_io::Rays& chunk, const std::vector<std::uint32_t>& order,
+                    openPMD_io::Rays& sorted) {
+	sorted.clear();
+	sorted.for_each(chunk, [&](field_t, auto& rec, const auto& src) {
+		rec.vals().reserve(order.size());
+		for (size_t i = 0; i < order.size(); ++i)
+			rec.push_back(src[order[i]]);
+	});
+	sorted.size(order.size());
+}
@@ -0,0 +1,28 @@
+#ifndef RAY_SORT_HH
+#define RAY_SORT_HH
+///\file
+#include "openPMD_io.hh"
+#include <cstdint>
+#include <vector>
+
+namespace raytracing {
+
+/// \brief name of the sort key, stored in the sortKey attribute
+const char* sort_key_name(sort_key_t key);
+
+/// \brief fields determining the order, their per-chunk ranges are stored as attributes
+std::vector<field_t> sort_fields(sort_key_t key);
+
+/** \brief order of the rays of the chunk according to the key
+ *
+ * kSortMorton interleaves the bits of x and y, quantized on 32 bits each over the range of the
+ * chunk. The sort is stable, so rays with the same key keep their arrival order.
+ */
+std::vector<std::uint32_t> sort_permutation(const openPMD_io::Rays& chunk, sort_key_t key);
+
+/// \brief copies the rays of the chunk in the given order
+void permute(const openPMD_io::Rays& chunk, const std::vector<std::uint32_t>& order,
+             openPMD_io::Rays& sorted);
+
+} // namespace raytracing
+#endif
@@ -0,0 +1,233 @@
+#include "ray_stats.hh"
+#include "ray_threads.hh"
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+///\file
+
+using raytracing::beam_stats;
+using raytracing::field_t;
+
+constexpr unsigned int beam_stats::kNStatFields;
+
+namespace {
+constexpr unsigned int kN = beam_stats::kNStatFields;
+/// number of rays converted to double at once
+constexpr size_t kBlock = 1024;
+/// independent partial sums, kept in vector registers by the compiler: a single accumulator
+/// cannot be vectorized without reassociating the additions (-ffast-math)
+constexpr unsigned int kLanes = 4;
+
+const field_t kStatFields[kN] = {raytracing::kX,  raytracing::kY,  raytracing::kZ,
+                                 raytracing::kDX, raytracing::kDY, raytracing::kDZ,
+                                 raytracing::kWavelength, raytracing::kTime};
+
+unsigned int
+stat_index(field_t f) {
+	for (unsigned int i = 0; i < kN; ++i)
+		if (kStatFields[i] == f) return i;
+	throw std::runtime_error("No statistics for this ray property");
+}
+
+/// sum of a[i] * b[i]
+double
+dot(const double* a, const double* b, size_t n) {
+	double lane[kLanes] = {0.};
+	size_t i            = 0;
+	for (; i + kLanes <= n; i += kLanes)
+		for (unsigned int l = 0; l < kLanes; ++l)
+			lane[l] += a[i + l] * b[i + l];
+	for (; i < n; ++i)
+		lane[0] += a[i] * b[i];
+	return (lane[0] + lane[1]) + (lane[2] + lane[3]);
+}
+} // namespace
+
+//------------------------------------------------------------
+beam_stats::beam_stats(): _n(0), _weight(0.), _weight_c(0.) {
+	std::fill(_mean, _mean + kN, 0.);
+	std::fill(&_comoment[0][0], &_comoment[0][0] + kN * kN, 0.);
+}
+
+//------------------------------------------------------------
+field_t
+beam_stats::stat_field(unsigned int i) {
+	if (i >= kN) throw std::runtime_error("No statistics for this ray property");
+	return kStatFields[i];
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * Two passes over the chunk, block by block: the weighted sums give the mean of the chunk,
+ * then the comoments are summed around it. The values are converted to double once per block.
+ */
+void
+beam_stats::add(const openPMD_io::Rays& rays) {
+	const float* data[kN] = {rays._x.data(),  rays._y.data(),  rays._z.data(),
+	                         rays._dx.data(), rays._dy.data(), rays._dz.data(),
+	                         rays._wavelength.data(), rays._time.data()};
+	const float* weight   = rays._weight.data();
+	size_t n              = rays.size();
+	if (n == 0) return;
+
+	std::vector<double> w(kBlock), d(kN * kBlock), wd(kN * kBlock);
+	double sum_w = 0., mean[kN] = {0.}, comoment[kN][kN] = {{0.}};
+	for (size_t begin = 0; begin < n; begin += kBlock) {
+		size_t m = std::min(kBlock, n - begin);
+		std::copy(weight + begin, weight + begin + m, w.begin());
+		for (size_t i = 0; i < m; ++i)
+			sum_w += w[i];
+		for (unsigned int a = 0; a < kN; ++a) {
+			std::copy(data[a] + begin, data[a] + begin + m, d.begin() + a * kBlock);
+			mean[a] += dot(w.data(), d.data() + a * kBlock, m);
+		}
+	}
+	if (sum_w == 0.) { // the rays do not contribute to the moments
+		merge(n, 0., mean, comoment);
+		return;
+	}
+	for (unsigned int a = 0; a < kN; ++a)
+		mean[a] /= sum_w;
+
+	for (size_t begin = 0; begin < n; begin += kBlock) {
+		size_t m = std::min(kBlock, n - begin);
+		std::copy(weight + begin, weight + begin + m, w.begin());
+		for (unsigned int a = 0; a < kN; ++a) {
+			double* da  = d.data() + a * kBlock;
+			double* wda = wd.data() + a * kBlock;
+			for (size_t i = 0; i < m; ++i) {
+				da[i]  = data[a][begin + i] - mean[a];
+				wda[i] = w[i] * da[i];
+			}
+		}
+		for (unsigned int a = 0; a < kN; ++a)
+			for (unsigned int b = a; b < kN; ++b)
+				comoment[a][b] += dot(wd.data() + a * kBlock, d.data() + b * kBlock, m);
+	}
+	merge(n, sum_w, mean, comoment);
+}
+
+//------------------------------------------------------------
+void
+beam_stats::merge(const beam_stats& other) {
+	merge(other._n, other._weight, other._mean, other._comoment);
+}
+
+//------------------------------------------------------------
+void
+beam_stats::merge(unsigned long long int n, double w, const double* mean,
+                  const double (*comoment)[kNStatFields]) {
+	_n += n;
+	if (w == 0.) return;
+
+	double total = _weight + w;
+	if (_weight == 0. || total == 0.) {
+		for (unsigned int a = 0; a < kN; ++a) {
+			if (_weight == 0.) _mean[a] = mean[a];
+			for (unsigned int b = a; b < kN; ++b)
+				_comoment[a][b] += comoment[a][b];
+		}
+	} else {
+		double delta[kN];
+		for (unsigned int a = 0; a < kN; ++a)
+			delta[a] = mean[a] - _mean[a];
+		double f = _weight * w / total;
+		for (unsigned int a = 0; a < kN; ++a) {
+			for (unsigned int b = a; b < kN; ++b)
+				_comoment[a][b] += comoment[a][b] + delta[a] * delta[b] * f;
+			_mean[a] += delta[a] * w / total;
+		}
+	}
+
+	// Kahan summation of the weights
+	double y  = w - _weight_c;
+	double t  = _weight + y;
+	_weight_c = (t - _weight) - y;
+	_weight   = t;
+}
+
+//------------------------------------------------------------
+double
+beam_stats::mean(field_t f) const {
+	return _mean[stat_index(f)];
+}
+
+//------------------------------------------------------------
+double
+beam_stats::covariance(field_t f, field_t g) const {
+	unsigned int a = stat_index(f), b = stat_index(g);
+	if (_weight == 0.) return 0.;
+	return _comoment[std::min(a, b)][std::max(a, b)] / _weight;
+}
+
+//------------------------------------------------------------
+double
+beam_stats::rms(field_t f) const {
+	return std::sqrt(std::max(0., covariance(f, f)));
+}
+
+//------------------------------------------------------------
+double
+beam_stats::emittance(field_t f) const {
+	field_t df;
+	if (f == kX)
+		df = kDX;
+	else if (f == kY)
+		df = kDY;
+	else
+		throw std::runtime_error("The emittance is defined for the x and y planes only");
+	double c = covariance(f, df);
+	return std::sqrt(std::max(0., covariance(f, f) * covariance(df, df) - c * c));
+}
+
+//------------------------------------------------------------
+beam_stats
+raytracing::compute_stats(const std::string& input, const std::string& particle_species,
+                          unsigned int iter, const stats_options& options) {
+	unsigned long long int n_rays;
+	{
+		openPMD_io reader(input);
+		n_rays = reader.init_read(particle_species, iter);
+	}
+
+	unsigned int n_threads = io_threads({input}, options.n_threads);
+	if (n_rays < n_threads) n_threads = std::max(1ull, n_rays);
+	std::vector<beam_stats> partial(n_threads);
+	std::vector<std::exception_ptr> errors(n_threads);
+	auto reduce = [&](unsigned int t) {
+		unsigned long long int first = t * n_rays / n_threads;
+		unsigned long long int last  = (t + 1) * n_rays / n_threads;
+		if (last == first) return; // n_rays=0 would read all
+		try {
+			openPMD_io reader(input);
+			reader.set_chunk_size(options.chunk_size);
+			reader.set_projection(field_mask({kX, kY, kZ, kDX, kDY, kDZ, kWavelength, kTime,
+			                                  kWeight}));
+			reader.init_read(particle_species, iter, last);
+			reader.seek(first);
+			for (auto* chunk = &reader.read_chunk(); chunk->size() != 0;
+			     chunk       = &reader.read_chunk())
+				partial[t].add(*chunk);
+		} catch (...) {
+			errors[t] = std::current_exception();
+		}
+	};
+	if (n_threads == 1)
+		reduce(0);
+	else {
+		std::vector<std::thread> readers;
+		for (unsigned int t = 0; t < n_threads; ++t)
+			readers.emplace_back(reduce, t);
+		for (auto& t : readers)
+			t.join();
+	}
+	for (auto& e : errors)
+		if (e) std::rethrow_exception(e);
+
+	beam_stats stats;
+	for (const auto& p : partial)
+		stats.merge(p);
+	return stats;
+}
@@ -0,0 +1,30 @@
+#include "ray_threads.hh"
+#include <iostream>
+///\file
+
+namespace {
+/// true if the extension is the one of a backend that can be used from several threads
+bool
+is_thread_safe(const std::string& filename) {
+	static const char* extensions[] = {".bp", ".bp4", ".bp5", ".sst", ".ssc", ".json"};
+	size_t dot = filename.find_last_of('.');
+	if (dot == std::string::npos) return false;
+	std::string extension = filename.substr(dot);
+	for (auto e : extensions)
+		if (extension == e) return true;
+	return false;
+}
+} // namespace
+
+//------------------------------------------------------------
+unsigned int
+raytracing::io_threads(const std::vector<std::string>& filenames, unsigned int n_threads) {
+	if (n_threads <= 1) return 1;
+	for (const auto& f : filenames)
+		if (!is_thread_safe(f)) {
+			std::cerr << "[WARNING] " << f << " is not read or written by an openPMD backend "
+			          << "known to be thread safe, using a single thread" << std::endl;
+			return 1;
+		}
+	return n_threads;
+}
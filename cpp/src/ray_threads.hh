@@ -0,0 +1,19 @@
+#ifndef RAY_THREADS_HH
+#define RAY_THREADS_HH
+///\file
+#include <string>
+#include <vector>
+
+namespace raytracing {
+
+/** \brief number of threads that can use the openPMD API at once on the given files
+ *
+ * The files are only processed in parallel, with one openPMD::Series per thread, by the
+ * backends that allow it: ADIOS2 and JSON. HDF5 is usually built without thread safety, so
+ * as soon as one of the files is not known to be safe, a single thread is used and a warning
+ * is printed if more were requested.
+ */
+unsigned int io_threads(const std::vector<std::string>& filenames, unsigned int n_threads);
+
+} // namespace raytracing
+#endif
@@ -7,9 +7,6 @@
 using raytracing::openPMD_io;
 using raytracing::Ray;
 // using raytracing::openPMD_io::Rays;
-#ifndef V2SE
-#define VS2E 5.22703725e-6 /* Convert (v[m/s])**2 to E[meV] */
-#endif
 namespace raytracing {
 std::ostream&
 operator<<(std::ostream& os, const Ray& ray) {
@@ -58,20 +55,26 @@ Ray
 openPMD_io::Rays::pop(bool next) {
 
 	Ray r;
-	r.set_position(_x[_read], _y[_read], _z[_read]);
-	r.set_direction(_dx[_read], _dy[_read], _dz[_read]);
-
-	r.set_polarization(_sx[_read], _sy[_read], _sz[_read]);
-
-	r.set_sPolarization(_sPolAx[_read], _sPolAy[_read], _sPolAz[_read], _sPolPh[_read]);
-	r.set_pPolarization(_pPolAx[_read], _pPolAy[_read], _pPolAz[_read], _pPolPh[_read]);
-
-	r.set_wavelength(_wavelength[_read]);
-	r.set_time(_time[_read]);
-	r.set_weight(_weight[_read]);
-
-	r.set_id(_id[_read]);
-	r.set_status(_status[_read]);
+	// the records not loaded are empty: the ray keeps the default values
+	auto get = [this](const auto& rec, auto def) {
+		return rec.size() != 0 ? rec[_read] : def;
+	};
+	r.set_position(get(_x, 0.f), get(_y, 0.f), get(_z, 0.f));
+	r.set_direction(get(_dx, 0.f), get(_dy, 0.f), get(_dz, 0.f));
+
+	r.set_polarization(get(_sx, 0.f), get(_sy, 0.f), get(_sz, 0.f));
+
+	r.set_sPolarization(get(_sPolAx, 0.f), get(_sPolAy, 0.f), get(_sPolAz, 0.f),
+	                    get(_sPolPh, 0.f));
+	r.set_pPolarization(get(_pPolAx, 0.f), get(_pPolAy, 0.f), get(_pPolAz, 0.f),
+	                    get(_pPolPh, 0.f));
+
+	r.set_wavelength(get(_wavelength, 0.f));
+	r.set_time(get(_time, 0.f));
+	r.set_weight(get(_weight, 1.f));
+
+	r.set_id(get(_id, 0ull));
+	r.set_status(get(_status, kAlive));
 
 	if (next) ++_read;
 	return r;
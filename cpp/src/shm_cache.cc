@@ -0,0 +1,342 @@
+#include "shm_cache.hh"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+///\file
+
+using raytracing::shm_cache;
+
+#if defined(__unix__) || defined(__APPLE__)
+namespace {
+constexpr std::uint32_t kMagic = 0x52415943; // "RAYC"
+constexpr std::uint32_t kEmpty = 0, kFilling = 1, kReady = 2, kFailed = 3;
+constexpr size_t kColumnAlignment = 64; // cache line
+constexpr size_t kKeySize         = 512;
+constexpr size_t kMaxUsers        = 1024;    // processes attached at once
+constexpr size_t kMaxChunks       = 1 << 16; // entries of the chunk table
+constexpr size_t kMaxProbes       = 256;     // entries looked at before the table is full
+// time given to a living process filling a chunk before reading it from file
+constexpr std::chrono::seconds kFillTimeout(120);
+const char kPrefix[]     = "openPMDraytrace_";
+const char kDataSuffix[] = ".data";
+
+/// entry of the chunk table
+struct chunk_entry {
+	std::uint64_t offset, n_rays;
+	std::uint32_t state;
+	std::int32_t pid; ///< process filling the chunk
+};
+
+/// RAII lock of the index
+class index_lock {
+public:
+	explicit index_lock(int fd): _fd(fd) {
+		while (flock(_fd, LOCK_EX) != 0 && errno == EINTR) {}
+	}
+	~index_lock() { flock(_fd, LOCK_UN); }
+
+private:
+	int _fd;
+};
+
+size_t
+align(size_t pos) {
+	return (pos + kColumnAlignment - 1) / kColumnAlignment * kColumnAlignment;
+}
+
+size_t
+layout(std::uint64_t n_rays, std::uint64_t* offsets) {
+	size_t pos = 0;
+	for (unsigned int f = 0; f < raytracing::kNFields; ++f) {
+		offsets[f] = pos;
+		pos        = align(pos + n_rays * get_field_info(raytracing::field_t(f)).size);
+	}
+	return pos;
+}
+
+bool
+is_alive(std::int32_t pid) {
+	return kill(pid, 0) == 0 || errno == EPERM;
+}
+} // namespace
+
+/// index segment, zero-filled when created
+struct raytracing::shm_index {
+	std::uint32_t magic;
+	std::uint32_t removed;    ///< the names are unlinked, new processes create a new cache
+	std::uint32_t persistent; ///< kept when the last process detaches
+	std::uint64_t n_rays;
+	char key[kKeySize];
+	std::int32_t users[kMaxUsers]; ///< pid of each attachment, 0 if free
+	chunk_entry chunks[kMaxChunks];
+
+	// frees the slots of the processes that died without detaching
+	void prune_users(void) {
+		for (auto& u : users)
+			if (u != 0 && !is_alive(u)) u = 0;
+	}
+
+	// entry of the chunk, or a free entry, or nullptr if the table is full
+	chunk_entry* find(std::uint64_t offset, std::uint64_t n) {
+		size_t h = (offset * 0x9E3779B97F4A7C15ull ^ n) % kMaxChunks;
+		for (size_t i = 0; i < kMaxProbes; ++i) {
+			chunk_entry& e = chunks[(h + i) % kMaxChunks];
+			if (e.state == kEmpty || (e.offset == offset && e.n_rays == n)) return &e;
+		}
+		return nullptr;
+	}
+};
+
+//------------------------------------------------------------
+std::string
+shm_cache::segment_name(const std::string& key) {
+	std::ostringstream name;
+	name << "/" << kPrefix << std::hex << std::hash<std::string>()(key);
+	return name.str();
+}
+
+//------------------------------------------------------------
+shm_cache::shm_cache(const std::string& name, int fd):
+    _name(name), _fd(fd), _data_fd(-1), _index(nullptr), _data(nullptr), _size(0), _n_rays(0),
+    _attached(false) {}
+
+//------------------------------------------------------------
+shm_cache::~shm_cache() {
+	if (_attached) {
+		index_lock lock(_fd);
+		pid_t pid = getpid();
+		for (auto& u : _index->users)
+			if (u == pid) {
+				u = 0;
+				break;
+			}
+		_index->prune_users();
+		bool last = true;
+		for (auto u : _index->users)
+			last &= u == 0;
+		if (last && !_index->persistent) remove();
+	}
+	// the memory is freed by the system once the names are removed and nobody maps it
+	if (_data != nullptr) munmap(_data, _size);
+	if (_index != nullptr) munmap(_index, sizeof(shm_index));
+	if (_data_fd >= 0) close(_data_fd);
+	close(_fd);
+}
+
+//------------------------------------------------------------
+void
+shm_cache::remove(void) {
+	if (_index->removed) return;
+	_index->removed = 1;
+	shm_unlink((_name + kDataSuffix).c_str());
+	shm_unlink(_name.c_str());
+}
+
+//------------------------------------------------------------
+bool
+shm_cache::map_data(size_t size) {
+	int fd = shm_open((_name + kDataSuffix).c_str(), O_RDWR | O_CREAT, 0600);
+	if (fd < 0) return false;
+	struct stat st;
+	// the memory is only used by the chunks filled
+	bool sized = fstat(fd, &st) == 0 &&
+	             (static_cast<size_t>(st.st_size) == size ||
+	              (st.st_size == 0 && ftruncate(fd, size) == 0));
+	void* p = sized ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+	                : MAP_FAILED;
+	if (p == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	_data_fd = fd; // kept open for reserve()
+	_data    = static_cast<unsigned char*>(p);
+	_size    = size;
+	return true;
+}
+
+//------------------------------------------------------------
+bool
+shm_cache::reserve(std::uint64_t offset, std::uint64_t n_rays) {
+#ifdef __linux__
+	for (unsigned int f = 0; f < kNFields; ++f) {
+		size_t size = get_field_info(field_t(f)).size;
+		off_t begin = _offsets[f] + offset * size;
+		int error;
+		while ((error = posix_fallocate(_data_fd, begin, n_rays * size)) == EINTR) {}
+		if (error != 0) return false; // ENOSPC: no shared memory left
+	}
+#endif
+	return true;
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The index is created zero-filled and initialized with the lock held, so a process finding
+ * it without the magic number knows that its creator died and initializes it itself.
+ */
+std::unique_ptr<shm_cache>
+shm_cache::attach(const std::string& key, std::uint64_t n_rays, bool persistent) {
+	std::string name = segment_name(key);
+	// a cache removed between shm_open() and the lock is created again
+	for (int attempt = 0; attempt < 3; ++attempt) {
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+		if (fd < 0) return nullptr;
+		std::unique_ptr<shm_cache> cache(new shm_cache(name, fd));
+		index_lock lock(fd);
+
+		struct stat st;
+		if (fstat(fd, &st) != 0) return nullptr;
+		if (static_cast<size_t>(st.st_size) != sizeof(shm_index) &&
+		    (st.st_size != 0 || ftruncate(fd, sizeof(shm_index)) != 0))
+			return nullptr; // not an index of this version
+		void* p = mmap(nullptr, sizeof(shm_index), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) return nullptr;
+		shm_index* index = cache->_index = static_cast<shm_index*>(p);
+		if (index->removed) continue;
+
+		bool created = index->magic != kMagic;
+		if (!created && (index->n_rays != n_rays ||
+		                 std::strncmp(index->key, key.c_str(), kKeySize - 1) != 0))
+			return nullptr; // name collision
+		cache->_n_rays = n_rays;
+		if (!cache->map_data(layout(n_rays, cache->_offsets))) return nullptr;
+		if (created) {
+			index->n_rays = n_rays;
+			std::strncpy(index->key, key.c_str(), kKeySize - 1);
+			index->key[kKeySize - 1] = '\0';
+			index->magic             = kMagic;
+		}
+		if (persistent) index->persistent = 1;
+
+		index->prune_users();
+		for (auto& u : index->users)
+			if (u == 0) {
+				u                = getpid();
+				cache->_attached = true;
+				return cache;
+			}
+		return nullptr; // too many processes
+	}
+	return nullptr;
+}
+
+//------------------------------------------------------------
+/** \internal \remark
+ * The lock is not held while filling the chunk: the other processes poll the state of the
+ * entry, and take it over if the process filling it died.
+ */
+bool
+shm_cache::get(std::uint64_t offset, std::uint64_t n_rays, const fill_t& fill) {
+	if (offset + n_rays > _n_rays) return false;
+	// the segment is sparse: without reserving its pages, running out of shared memory would
+	// kill the process with SIGBUS while filling the chunk
+	if (!reserve(offset, n_rays)) return false;
+	chunk_entry* entry = nullptr;
+	auto start         = std::chrono::steady_clock::now();
+	for (;;) {
+		{
+			index_lock lock(_fd);
+			entry = _index->find(offset, n_rays);
+			if (entry == nullptr) return false;
+			if (entry->state == kReady) return true;
+			if (entry->state != kFilling || !is_alive(entry->pid)) {
+				entry->offset = offset;
+				entry->n_rays = n_rays;
+				entry->state  = kFilling;
+				entry->pid    = getpid();
+				break;
+			}
+		}
+		if (std::chrono::steady_clock::now() - start > kFillTimeout) return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	void* columns[kNFields];
+	for (unsigned int f = 0; f < kNFields; ++f)
+		columns[f] = _data + _offsets[f] + offset * get_field_info(field_t(f)).size;
+	try {
+		fill(columns);
+	} catch (...) {
+		index_lock lock(_fd);
+		entry->state = kFailed;
+		throw;
+	}
+	index_lock lock(_fd);
+	entry->state = kReady;
+	return true;
+}
+
+//------------------------------------------------------------
+unsigned int
+shm_cache::purge(const std::string& prefix) {
+	// the POSIX shared memory segments are the files of /dev/shm on Linux
+	std::vector<std::string> names;
+	if (DIR* dir = opendir("/dev/shm")) {
+		while (dirent* e = readdir(dir)) {
+			std::string s = e->d_name;
+			size_t n      = sizeof(kDataSuffix) - 1;
+			if (s.compare(0, sizeof(kPrefix) - 1, kPrefix) == 0 &&
+			    (s.size() < n || s.compare(s.size() - n, n, kDataSuffix) != 0))
+				names.push_back("/" + s);
+		}
+		closedir(dir);
+	}
+
+	unsigned int n_removed = 0;
+	for (auto& name : names) {
+		int fd = shm_open(name.c_str(), O_RDWR, 0600);
+		if (fd < 0) continue;
+		shm_cache cache(name, fd); // not attached: only unmaps and closes
+		index_lock lock(fd);
+		struct stat st;
+		if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != sizeof(shm_index))
+			continue;
+		void* p = mmap(nullptr, sizeof(shm_index), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) continue;
+		cache._index = static_cast<shm_index*>(p);
+		if (cache._index->removed ||
+		    std::strncmp(cache._index->key, prefix.c_str(), prefix.size()) != 0)
+			continue;
+		cache.remove();
+		++n_removed;
+	}
+	return n_removed;
+}
+
+#else
+//------------------------------------------------------------
+// without POSIX shared memory, the chunks are always read from file
+std::string
+shm_cache::segment_name(const std::string& key) {
+	return key;
+}
+
+shm_cache::~shm_cache() {}
+
+std::unique_ptr<shm_cache>
+shm_cache::attach(const std::string&, std::uint64_t, bool) {
+	return nullptr;
+}
+
+bool
+shm_cache::get(std::uint64_t, std::uint64_t, const fill_t&) {
+	return false;
+}
+
+unsigned int
+shm_cache::purge(const std::string&) {
+	return 0;
+}
+#endif
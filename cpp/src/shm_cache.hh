@@ -0,0 +1,92 @@
+#ifndef SHM_CACHE_HH
+#define SHM_CACHE_HH
+///\file
+#include "ray_fields.hh"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace raytracing {
+
+struct shm_index;
+
+/** \class shm_cache
+ * \brief chunks of rays shared between the processes of a node through POSIX shared memory
+ *
+ * The cache of a particle species (the key is made of the file, the iteration, the particle
+ * species and the fields loaded) is made of two segments:
+ *  - an index, with the table of the chunks loaded and the processes attached to the cache
+ *  - the data, laid out as one column per field for all the rays of the particle species.
+ * Only the memory of the chunks loaded is used, so processes reading different parts of the
+ * file, or with different chunk sizes, share the same cache.
+ *
+ * The first process asking for a chunk fills it, the others wait for it to be ready and use it
+ * without copying it. A chunk left half-filled by a process that died is filled again by the
+ * next one. The segments are removed when the last process detaches from the cache, unless
+ * the cache is persistent, in which case they stay until purge().
+ *
+ * The index is locked with flock() only while looking up or updating the table. If anything
+ * goes wrong (name collision, table full, no shared memory left), attach() and get() fail and
+ * the chunks should be read from file as usual. This is always the case on the systems without
+ * POSIX shared memory. The data segment is sparse: the memory of a chunk is reserved before
+ * filling it, on Linux, so that running out of shared memory is reported by get().
+ */
+class shm_cache {
+public:
+	/// \brief callback loading the rays in the columns, one pointer per field
+	typedef std::function<void(void* const* columns)> fill_t;
+
+	/** \brief attach to the cache of a particle species of n_rays rays, creating it if needed
+	 * \return the cache, or nullptr if it cannot be used
+	 */
+	static std::unique_ptr<shm_cache> attach(const std::string& key, std::uint64_t n_rays,
+	                                         bool persistent);
+
+	/// \brief detach from the cache, and remove it if this was the last process attached
+	~shm_cache();
+	shm_cache(const shm_cache&) = delete;
+	shm_cache& operator=(const shm_cache&) = delete;
+
+	/** \brief make the n_rays rays from offset available, loading them with fill if needed
+	 * \return false if the chunk cannot be cached
+	 */
+	bool get(std::uint64_t offset, std::uint64_t n_rays, const fill_t& fill);
+
+	/// \brief pointer to the value of the ray at the given offset in the column
+	template <typename T> const T* column(field_t f, std::uint64_t offset) const {
+		return reinterpret_cast<const T*>(_data + _offsets[f]) + offset;
+	}
+
+	/** \brief remove the caches whose key starts with prefix, all of them if empty
+	 *
+	 * The processes attached keep using them, the next ones create a new cache.
+	 * \return the number of caches removed
+	 */
+	static unsigned int purge(const std::string& prefix);
+
+	/// \brief name of the index segment for the given key
+	static std::string segment_name(const std::string& key);
+
+private:
+	shm_cache(const std::string& name, int fd);
+	// maps the data segment, creating it with the given size if needed
+	bool map_data(size_t size);
+	// removes the segments, with the index locked
+	void remove(void);
+	// commits the memory of the chunk in the data segment, false if there is not enough
+	bool reserve(std::uint64_t offset, std::uint64_t n_rays);
+
+	std::string _name;
+	int _fd;      // index segment, kept open for flock()
+	int _data_fd; // data segment
+	shm_index* _index;
+	unsigned char* _data;
+	size_t _size;
+	std::uint64_t _n_rays;
+	std::uint64_t _offsets[kNFields];
+	bool _attached;
+};
+
+} // namespace raytracing
+#endif
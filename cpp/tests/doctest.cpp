@@ -2,6 +2,19 @@
 #include <doctest/doctest.h>
 
 #include <openPMD_io.hh>
+#include <openPMD_io_c.h>
+#ifdef OPENPMDRAYTRACE_ARROW
+#include <ray_arrow.hh>
+#endif
+#include <ray_buffer_pool.hh>
+#include <ray_columnar.hh>
+#include <ray_merge.hh>
+#include <ray_multi_reader.hh>
+#include <ray_pipeline.hh>
+#include <ray_session.hh>
+#include <ray_shard.hh>
+#include <ray_stats.hh>
+#include <ray_units.hh>
 using namespace raytracing;
 
 #include <doctest/doctest.h>
@@ -80,3 +93,828 @@ TEST_CASE("[openPMD_io] Write") {
 
 	
 }
+
+TEST_CASE("[openPMD_io] Streaming") {
+	// the step API is backend agnostic: JSON is used here, ADIOS2 SST is used in production
+	std::string filename = "test_stream.json";
+	unsigned long long int n_rays_max = 11;
+	unsigned int iter                 = 1;
+
+	{ // the writer is closed at the end of the scope
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.set_streaming(true);
+		CHECK(iow.is_streaming());
+		iow.init_write("2112", n_rays_max, iter);
+		iow.set_gravity_direction(0.33, 0.33, 0.33);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < n_rays_max; ++i) {
+			myray.set_position(i + 1, i + 2, i + 3);
+			iow.trace_write(myray);
+		}
+		// the last partial chunk is written in a last step when the writer is closed
+	}
+
+	raytracing::openPMD_io ior(filename);
+	ior.set_streaming(true);
+	ior.init_read("2112", iter);
+
+	float x = 3, y = 5, z = 7;
+	ior.get_gravity_direction(&x, &y, &z);
+	CHECK(x == doctest::Approx(0.33));
+
+	unsigned int i = 0;
+	while (!ior.is_read_finished()) {
+		auto ray = ior.trace_read();
+		CHECK(ray.x() == doctest::Approx(i + 1));
+		CHECK(ray.z() == doctest::Approx(i + 3));
+		++i;
+	}
+	CHECK(i == n_rays_max);
+	CHECK_THROWS(ior.trace_read());
+}
+
+TEST_CASE("[openPMD_io] Follow") {
+	std::string filename = "test_follow.json";
+	unsigned long long int n_rays_max = 11;
+	unsigned int iter                 = 1;
+	raytracing::Ray myray;
+
+	raytracing::openPMD_io iow(filename, "test code");
+	iow.init_write("2112", n_rays_max, iter);
+	for (size_t i = 0; i < 6; ++i) {
+		myray.set_position(i + 1, i + 2, i + 3);
+		iow.trace_write(myray);
+	}
+	iow.save_write(); // first 6 rays are committed
+
+	raytracing::openPMD_io ior(filename);
+	ior.set_follow(true, 0.1, 0.01);
+	CHECK(ior.init_read("2112", iter) == 6);
+	unsigned int i = 0;
+	while (!ior.is_read_finished()) {
+		CHECK(ior.trace_read().x() == doctest::Approx(i + 1));
+		++i;
+	}
+	CHECK(i == 6); // timeout, nothing new has been committed
+
+	for (size_t j = 6; j < n_rays_max; ++j) {
+		myray.set_position(j + 1, j + 2, j + 3);
+		iow.trace_write(myray);
+	}
+	iow.save_write();
+
+	while (!ior.is_read_finished()) {
+		CHECK(ior.trace_read().x() == doctest::Approx(i + 1));
+		++i;
+	}
+	CHECK(i == n_rays_max);
+}
+
+TEST_CASE("[columnar] Conversion") {
+	std::string filename = "test_columnar.json";
+	unsigned long long int n_rays_max = 11;
+	unsigned int iter                 = 1;
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.init_write("2112", n_rays_max, iter);
+		iow.set_gravity_direction(0.33, 0.33, 0.33);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < n_rays_max; ++i) {
+			myray.set_position(i + 1, i + 2, i + 3);
+			myray.set_id(i);
+			iow.trace_write(myray);
+		}
+		iow.save_write();
+	}
+
+	raytracing::openPMD_to_columnar(filename, "2112", iter, "test_columnar.rays");
+	CHECK(raytracing::columnar_file::is_columnar("test_columnar.rays"));
+	CHECK_FALSE(raytracing::columnar_file::is_columnar(filename));
+
+	// read back the native file with the same API
+	raytracing::openPMD_io ior("test_columnar.rays");
+	CHECK(ior.init_read("2112", iter) == n_rays_max);
+	float x = 0, y = 0, z = 0;
+	ior.get_gravity_direction(&x, &y, &z);
+	CHECK(x == doctest::Approx(0.33));
+	for (unsigned int i = 0; i < n_rays_max; ++i) {
+		auto ray = ior.trace_read();
+		CHECK(ray.x() == doctest::Approx(i + 1));
+		CHECK(ray.get_id() == i);
+	}
+	CHECK(ior.is_read_finished());
+
+	// and back to openPMD
+	raytracing::columnar_to_openPMD("test_columnar.rays", "test_columnar_back.json");
+	raytracing::openPMD_io iob("test_columnar_back.json");
+	CHECK(iob.init_read("2112", iter) == n_rays_max);
+	for (unsigned int i = 0; i < n_rays_max; ++i)
+		CHECK(iob.trace_read().z() == doctest::Approx(i + 3));
+}
+
+TEST_CASE("[openPMD_io] Shared cache") {
+	std::string filename = "test_shared.json";
+	unsigned long long int n_rays_max = 11;
+	unsigned int iter                 = 1;
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.init_write("2112", n_rays_max, iter);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < n_rays_max; ++i) {
+			myray.set_position(i + 1, i + 2, i + 3);
+			iow.trace_write(myray);
+		}
+		iow.save_write();
+	}
+
+	{ // the second reader finds the chunks loaded by the first one in shared memory
+		raytracing::openPMD_io ior1(filename), ior2(filename);
+		ior1.set_shared_cache(true);
+		ior2.set_shared_cache(true);
+		ior1.init_read("2112", iter);
+		ior2.init_read("2112", iter);
+		for (unsigned int i = 0; i < n_rays_max; ++i) {
+			CHECK(ior1.trace_read().x() == doctest::Approx(i + 1));
+			CHECK(ior2.trace_read().x() == doctest::Approx(i + 1));
+		}
+	}
+	// removed with the last reader
+	CHECK(raytracing::openPMD_io::purge_shared_cache(filename) == 0);
+
+	{ // a persistent cache is kept until purged
+		raytracing::openPMD_io ior(filename);
+		ior.set_shared_cache(true, true);
+		ior.init_read("2112", iter);
+		CHECK(ior.trace_read().x() == doctest::Approx(1));
+	}
+	CHECK(raytracing::openPMD_io::purge_shared_cache(filename) == 1);
+	CHECK(raytracing::openPMD_io::purge_shared_cache(filename) == 0);
+}
+
+TEST_CASE("[openPMD_io] Multiple species") {
+	std::string filename = "test_species.json";
+	unsigned int iter    = 1;
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.init_write("2112", 7, iter);
+		iow.init_rays("22", 4, iter);
+		raytracing::Ray myray;
+		// the rays of the two species are interleaved, as produced by a simulation
+		for (size_t i = 0; i < 7; ++i) {
+			myray.set_position(i + 1, 0, 0);
+			iow.trace_write("2112", myray);
+			if (i < 4) {
+				myray.set_position(-(i + 1.), 0, 0);
+				iow.trace_write("22", myray);
+			}
+		}
+		iow.save_write();
+	}
+
+	raytracing::openPMD_io ior(filename);
+	auto index = ior.file_index();
+	CHECK(index.size() == 1);
+	CHECK(index[iter]["2112"] == 7);
+	CHECK(index[iter]["22"] == 4);
+
+	CHECK(ior.init_read("2112", iter) == 7);
+	for (unsigned int i = 0; i < 7; ++i)
+		CHECK(ior.trace_read().x() == doctest::Approx(i + 1));
+	CHECK(ior.init_read("22", iter) == 4);
+	for (unsigned int i = 0; i < 4; ++i)
+		CHECK(ior.trace_read().x() == doctest::Approx(-(i + 1.)));
+	CHECK_THROWS(ior.init_read("11", iter));
+	CHECK_THROWS(ior.init_read("2112", iter + 1));
+}
+
+TEST_CASE("[openPMD_io] Population control") {
+	std::string filename              = "test_population.json";
+	unsigned long long int n_rays_max = 100, n_generated = 1000;
+	unsigned int iter                 = 1;
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.init_write("2112", n_rays_max, iter);
+		iow.set_population_control(n_generated, false, 42);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < n_generated; ++i)
+			iow.trace_write(myray);
+		iow.save_write();
+	}
+
+	raytracing::openPMD_io ior(filename);
+	auto nrays = ior.init_read("2112", iter);
+	CHECK(nrays > 0);
+	CHECK(nrays <= n_rays_max);
+	// the total weight is preserved on average
+	double weight = 0;
+	for (unsigned int i = 0; i < nrays; ++i)
+		weight += ior.trace_read().get_weight();
+	CHECK(weight == doctest::Approx(n_generated).epsilon(0.3));
+}
+
+TEST_CASE("[openPMD_io] Sampled read") {
+	std::string filename              = "test_sampled.json";
+	unsigned long long int n_rays_max = 20, k = 5;
+	unsigned int iter                 = 1;
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.init_write("2112", n_rays_max, iter);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < n_rays_max; ++i) {
+			myray.set_position(i + 1, 0, 0);
+			iow.trace_write(myray);
+		}
+		iow.save_write();
+	}
+
+	for (auto mode : {raytracing::kUniform, raytracing::kStratified}) {
+		raytracing::openPMD_io ior(filename);
+		ior.set_sampling(mode, 7);
+		CHECK(ior.init_read("2112", iter, k) == k);
+		float last = 0;
+		for (unsigned int i = 0; i < k; ++i) {
+			auto ray = ior.trace_read();
+			CHECK(ray.x() > last); // in the order of the file, without repetitions
+			CHECK(ray.get_weight() == doctest::Approx(double(n_rays_max) / k));
+			if (mode == raytracing::kStratified) {
+				CHECK(ray.x() > i * n_rays_max / k);
+				CHECK(ray.x() <= (i + 1) * n_rays_max / k);
+			}
+			last = ray.x();
+		}
+		CHECK(ior.is_read_finished());
+	}
+}
+
+TEST_CASE("[openPMD_io] Weighted read") {
+	std::string filename              = "test_weighted.json";
+	unsigned long long int n_rays_max = 10, n_draws = 1000;
+	unsigned int iter                 = 1;
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.init_write("22", 1, iter); // no ray written
+		iow.init_rays("2112", n_rays_max, iter);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < n_rays_max; ++i) {
+			myray.set_position(i, 0, 0);
+			myray.set_weight(i < 5 ? 0. : 1.); // half of the rays never contribute
+			iow.trace_write(myray);
+		}
+		iow.save_write();
+	}
+
+	raytracing::openPMD_io ior(filename);
+	ior.set_sampling(raytracing::kWeighted, 3);
+	// more draws than rays in the file
+	CHECK(ior.init_read("2112", iter, n_draws) == n_draws);
+	for (unsigned int i = 0; i < n_draws; ++i) {
+		auto ray = ior.trace_read();
+		CHECK(ray.x() >= 5);
+		CHECK(ray.get_weight() == doctest::Approx(5. / n_draws));
+	}
+	CHECK(ior.is_read_finished());
+
+	// nothing to draw from
+	CHECK_THROWS_AS(ior.init_read("22", iter, n_draws), std::runtime_error);
+}
+
+TEST_CASE("[openPMD_io] Sorted write") {
+	std::string filename              = "test_sorted.json";
+	unsigned long long int n_rays_max = 6;
+	unsigned int iter                 = 1;
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.set_sort(raytracing::kSortWavelength);
+		iow.init_write("2112", n_rays_max, iter);
+		// a single chunk, so that the whole file is sorted
+		raytracing::openPMD_io::Rays chunk;
+		raytracing::Ray myray;
+		for (size_t i = 0; i < n_rays_max; ++i) {
+			myray.set_position(i, 0, 0);
+			myray.set_wavelength(n_rays_max - i); // decreasing
+			chunk.push(myray);
+		}
+		iow.write_chunk(chunk);
+	}
+
+	raytracing::openPMD_io ior(filename);
+	ior.init_read("2112", iter);
+	for (unsigned int i = 0; i < n_rays_max; ++i) {
+		auto ray = ior.trace_read();
+		CHECK(ray.get_wavelength() == doctest::Approx(i + 1));
+		CHECK(ray.x() == doctest::Approx(n_rays_max - i - 1));
+	}
+}
+
+// minValue and maxValue attributes of the x position of a particle species
+std::pair<float, float>
+x_range(const std::string& filename, const std::string& particle_species, unsigned int iter) {
+	openPMD::Series series(filename, openPMD::Access::READ_ONLY);
+	auto x = series.iterations[iter].particles[particle_species]["position"]["x"];
+	return {x.getAttribute("minValue").get<float>(), x.getAttribute("maxValue").get<float>()};
+}
+
+TEST_CASE("[merge] Concatenation") {
+	std::vector<std::string> inputs = {"test_merge_1.json", "test_merge_2.json"};
+	unsigned int iter               = 1;
+	for (size_t f = 0; f < inputs.size(); ++f) {
+		raytracing::openPMD_io iow(inputs[f], "test code");
+		iow.init_write("2112", 4, iter);
+		iow.set_gravity_direction(0, -1, 0);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 4; ++i) {
+			myray.set_position(f * 4 + i, 0, 0);
+			myray.set_id(7);
+			iow.trace_write(myray);
+		}
+	}
+
+	raytracing::merge_options options;
+	options.renumber_id = true;
+	options.chunk_size  = 3; // chunks across the file boundaries
+	CHECK(raytracing::merge_files(inputs, "test_merged.json", "2112", iter, options) == 8);
+
+	raytracing::openPMD_io ior("test_merged.json");
+	CHECK(ior.init_read("2112", iter) == 8);
+	float x, y, z;
+	ior.get_gravity_direction(&x, &y, &z);
+	CHECK(y == doctest::Approx(-1));
+	for (unsigned int i = 0; i < 8; ++i) {
+		auto ray = ior.trace_read();
+		CHECK(ray.x() == doctest::Approx(i));
+		CHECK(ray.get_id() == i);
+	}
+
+	// the chunks read are written as they are: the ranges come from their values
+	options.renumber_id = false;
+	CHECK(raytracing::merge_files(inputs, "test_merged_ids.json", "2112", iter, options) == 8);
+	auto range = x_range("test_merged_ids.json", "2112", iter);
+	CHECK(range.first == doctest::Approx(0));
+	CHECK(range.second == doctest::Approx(7));
+}
+
+TEST_CASE("[shard] Split") {
+	unsigned int iter = 1;
+	{
+		raytracing::openPMD_io iow("test_split.json", "test code");
+		iow.init_write("2112", 10, iter);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 10; ++i) {
+			myray.set_position(i, 0, 0);
+			myray.set_weight(i < 5 ? 1 : 3); // the last rays carry most of the weight
+			iow.trace_write(myray);
+		}
+	}
+
+	raytracing::shard_options options;
+	options.chunk_size = 3;
+	SUBCASE("Count") {
+		auto shards = raytracing::split_file("test_split.json", "test_shard.json", "2112", 2,
+		                                     iter, options);
+		REQUIRE(shards.size() == 2);
+		CHECK(shards[0].filename == "test_shard_0.json");
+		CHECK(shards[0].last == 5);
+		CHECK(shards[1].weight == doctest::Approx(15));
+
+		raytracing::openPMD_io ior(shards[1].filename);
+		CHECK(ior.init_read("2112", iter) == 5);
+		CHECK(ior.trace_read().x() == doctest::Approx(5));
+		auto range = x_range(shards[1].filename, "2112", iter);
+		CHECK(range.first == doctest::Approx(5));
+		CHECK(range.second == doctest::Approx(9));
+	}
+	SUBCASE("Weight") {
+		options.balance = raytracing::kBalanceWeight;
+		auto shards = raytracing::split_file("test_split.json", "test_shard.json", "2112", 2,
+		                                     iter, options);
+		REQUIRE(shards.size() == 2);
+		// total weight 20: 5 rays of weight 1 and 2 of weight 3 reach 11
+		CHECK(shards[0].last == 7);
+		CHECK(shards[1].first == 7);
+		CHECK(shards[1].last == 10);
+		CHECK(shards[1].weight == doctest::Approx(9));
+	}
+}
+
+TEST_CASE("[stats] Moments") {
+	unsigned int iter = 1;
+	{
+		raytracing::openPMD_io iow("test_stats.json", "test code");
+		iow.init_write("2112", 8, iter);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 8; ++i) {
+			// x alternates between 99 and 101 and the divergence follows it
+			float x = (i % 2 == 0) ? 99 : 101;
+			myray.set_position(x, 0, 0);
+			myray.set_direction((x - 100) * 1e-3, 0, 1);
+			myray.set_weight(i < 4 ? 1 : 3);
+			iow.trace_write(myray);
+		}
+	}
+
+	raytracing::stats_options options;
+	options.chunk_size = 3; // partial results of the chunks and of the threads are merged
+	options.n_threads  = 2;
+	auto stats         = raytracing::compute_stats("test_stats.json", "2112", iter, options);
+	CHECK(stats.n_rays() == 8);
+	CHECK(stats.intensity() == doctest::Approx(16));
+	CHECK(stats.mean(kX) == doctest::Approx(100));
+	CHECK(stats.rms(kX) == doctest::Approx(1));
+	CHECK(stats.covariance(kX, kDX) == doctest::Approx(1e-3));
+	CHECK(stats.rms(kY) == doctest::Approx(0));
+	// the divergence is correlated to the position: no emittance
+	CHECK(stats.emittance(kX) == doctest::Approx(0));
+}
+
+TEST_CASE("[units] Batch conversions") {
+	double x[2] = {0.01, -0.02}, y[2] = {0, 0}, z[2] = {1, 2};
+	double vx[2] = {0, 300}, vy[2] = {0, 0}, vz[2] = {2200, 400};
+	double t[2] = {1e-3, 2e-3}, p[2] = {0.5, 2};
+
+	raytracing::openPMD_io::Rays rays;
+	raytracing::push_mcstas_neutrons(rays, 2, x, y, z, vx, vy, vz, t, p);
+	REQUIRE(rays.size() == 2);
+	CHECK(rays._x[0] == doctest::Approx(1));   // cm
+	CHECK(rays._time[1] == doctest::Approx(2)); // ms
+	CHECK(rays._x.max() == doctest::Approx(1));
+
+	// same as the ray by ray conversion
+	raytracing::mcstas_neutron n;
+	n.set_velocity(vx[1], vy[1], vz[1]);
+	CHECK(rays._dx[1] == doctest::Approx(n.dx()));
+	CHECK(rays._wavelength[1] == doctest::Approx(n.get_wavelength()));
+
+	double x2[2], y2[2], z2[2], vx2[2], vy2[2], vz2[2], t2[2], p2[2];
+	raytracing::pop_mcstas_neutrons(rays, 0, 2, x2, y2, z2, vx2, vy2, vz2, t2, p2);
+	CHECK(x2[1] == doctest::Approx(x[1]));
+	CHECK(vz2[0] == doctest::Approx(vz[0]));
+	CHECK(vx2[1] == doctest::Approx(vx[1]));
+	CHECK(t2[0] == doctest::Approx(t[0]));
+
+	// thermal neutrons: 25.3 meV is 1.798 Angstrom
+	double energy = 25.3, back;
+	float wavelength;
+	raytracing::energy_to_wavelength<units::angstrom>(&energy, 1, &wavelength);
+	CHECK(wavelength == doctest::Approx(1.798).epsilon(1e-3));
+	raytracing::wavelength_to_energy<units::angstrom>(&wavelength, 1, &back);
+	CHECK(back == doctest::Approx(energy));
+}
+
+TEST_CASE("[openPMD_io] Backend config") {
+	raytracing::backend_config config;
+	config.hdf5_chunk = 4; // smaller than the dataset: several HDF5 chunks
+	{
+		raytracing::openPMD_io iow("test_backend.h5", "test code");
+		iow.set_backend_config(config);
+		iow.init_write("2112", 10);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 10; ++i) {
+			myray.set_position(i, 0, 0);
+			iow.trace_write(myray);
+		}
+	}
+	raytracing::openPMD_io ior("test_backend.h5");
+	ior.set_backend_config(config);
+	CHECK(ior.init_read("2112") == 10);
+	for (size_t i = 0; i < 10; ++i)
+		CHECK(ior.trace_read().x() == doctest::Approx(i));
+}
+
+TEST_CASE("[multi_reader] Streams") {
+	std::string filename = "test_multi.json";
+	unsigned int iter    = 1;
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.init_write("2112", 7, iter);
+		iow.init_rays("22", 4, iter);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 7; ++i) {
+			myray.set_position(i, 0, 0);
+			iow.trace_write("2112", myray);
+			if (i < 4) {
+				myray.set_position(-(i + 1.), 0, 0);
+				iow.trace_write("22", myray);
+			}
+		}
+	}
+
+	// read on demand (default), then read ahead by a pool of threads
+	for (unsigned int n_threads : {1u, 2u}) {
+		raytracing::multi_reader_options options;
+		options.chunk_size = 3;
+		options.n_threads  = n_threads;
+		raytracing::multi_reader reader(filename, {{iter, "2112"}, {iter, "22"}}, options);
+		REQUIRE(reader.size() == 2);
+		CHECK(reader[0].n_rays() == 7);
+		CHECK(reader[1].n_rays() == 4);
+
+		// the streams are consumed independently
+		for (unsigned int i = 0; i < 4; ++i)
+			CHECK(reader[1].trace_read().x() == doctest::Approx(-(i + 1.)));
+		CHECK(reader[1].is_read_finished());
+		unsigned long long int n = 0;
+		for (auto* chunk = &reader[0].read_chunk(); chunk->size() != 0;
+		     chunk       = &reader[0].read_chunk()) {
+			for (size_t i = 0; i < chunk->size(); ++i)
+				CHECK(chunk->_x[i] == doctest::Approx(n + i));
+			n += chunk->size();
+		}
+		CHECK(n == 7);
+	}
+}
+
+TEST_CASE("[openPMD_io] Projection") {
+	std::string filename = "test_projection.json";
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.init_write("2112", 5);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 5; ++i) {
+			myray.set_position(i, 1, 2);
+			myray.set_weight(3);
+			iow.trace_write(myray);
+		}
+	}
+
+	raytracing::openPMD_io ior(filename);
+	ior.set_projection(field_mask({kX, kWeight}));
+	CHECK(ior.init_read("2112") == 5);
+	auto ray = ior.trace_read();
+	CHECK(ray.x() == doctest::Approx(0));
+	CHECK(ray.get_weight() == doctest::Approx(3));
+	CHECK(ray.y() == doctest::Approx(0)); // not loaded: default value
+
+	ior.init_read("2112");
+	const auto& chunk = ior.read_chunk();
+	CHECK(chunk._x.size() == chunk.size());
+	CHECK(chunk._y.size() == 0);
+}
+
+TEST_CASE("[openPMD_io] Replay") {
+	std::string filename = "test_replay.json";
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.init_write("2112", 4);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 4; ++i) {
+			myray.set_position(i, 0, 0);
+			iow.trace_write(myray);
+		}
+	}
+
+	raytracing::openPMD_io ior(filename);
+	ior.set_replay(1 << 20, true);
+	CHECK(ior.init_read("2112", 1, 10) == 10);
+	for (unsigned int i = 0; i < 10; ++i)
+		CHECK(ior.trace_read().x() == doctest::Approx(i % 4));
+	CHECK(ior.is_read_finished());
+
+	// the buffer is reused: the whole species is a single chunk
+	ior.set_replay(1 << 20);
+	CHECK(ior.init_read("2112") == 4);
+	CHECK(ior.read_chunk().size() == 4);
+	CHECK(ior.read_chunk().size() == 0);
+
+	// too large for the budget: read from file
+	ior.set_replay(1);
+	CHECK(ior.init_read("2112") == 4);
+	CHECK(ior.trace_read().x() == doctest::Approx(0));
+}
+
+TEST_CASE("[pipeline] Read and write") {
+	std::string filename = "test_pipeline.json";
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.set_write_pipeline(make_pipeline(cut_status(kAlive) | shift(0, 0, 10)));
+		iow.init_write("2112", 10);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 10; ++i) {
+			myray.set_position(i, 0, 0);
+			myray.set_status(i % 2 == 0 ? kAlive : kDead);
+			iow.trace_write(myray);
+		}
+	}
+
+	double weight           = 0;
+	raytracing::openPMD_io ior(filename);
+	ior.set_chunk_size(2);
+	ior.set_read_pipeline(make_pipeline(
+	        cut_range(kX, 5, 10) | scale_weight(2) |
+	        reduce(weight, [](double& w, const ray_columns& c, size_t i) { w += c[kWeight][i]; })));
+	ior.init_read("2112");
+	std::vector<float> x;
+	while (!ior.is_read_finished()) {
+		auto ray = ior.trace_read();
+		CHECK(ray.z() == doctest::Approx(10));
+		CHECK(ray.get_weight() == doctest::Approx(2));
+		x.push_back(ray.x());
+	}
+	CHECK(x == std::vector<float>({6, 8}));
+	CHECK(weight == doctest::Approx(4));
+}
+
+TEST_CASE("[pipeline] Set while writing") {
+	std::string filename = "test_pipeline_pending.json";
+	{
+		raytracing::openPMD_io iow(filename, "test code");
+		iow.init_write("2112", 8);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 8; ++i) {
+			// the rays pending are written before the pipeline changes
+			if (i == 4) iow.set_write_pipeline(make_pipeline(shift(0, 0, 10)));
+			myray.set_position(i, 0, 0);
+			iow.trace_write(myray);
+		}
+	}
+
+	raytracing::openPMD_io ior(filename);
+	CHECK(ior.init_read("2112") == 8);
+	for (size_t i = 0; i < 8; ++i) {
+		auto ray = ior.trace_read();
+		CHECK(ray.x() == doctest::Approx(i));
+		CHECK(ray.z() == doctest::Approx(i < 4 ? 0 : 10));
+	}
+}
+
+TEST_CASE("[session] Components in one file") {
+	std::string filename = "test_session.json";
+	{
+		raytracing::ray_session session(filename, "test code");
+		session.set_chunk_size(2);
+		auto& source  = session.add_component("source", "2112", 5);
+		auto& monitor = session.add_component("monitor", "2112", 5);
+		CHECK(session.iteration("monitor") == 2);
+		CHECK_THROWS(session.add_component("source", "22", 5));
+		CHECK_THROWS(monitor.init_write("2112", 5));
+
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 5; ++i) {
+			myray.set_position(i, 0, 0);
+			source.trace_write(myray);
+			myray.set_position(0, i, 0);
+			if (i < 3) monitor.trace_write(myray);
+		}
+	}
+
+	raytracing::openPMD_io ior(filename);
+	CHECK(ior.init_read("2112", 1) == 5);
+	for (size_t i = 0; i < 5; ++i)
+		CHECK(ior.trace_read().x() == doctest::Approx(i));
+	CHECK(ior.init_read("2112", 2) == 3);
+	ior.trace_read();
+	CHECK(ior.trace_read().y() == doctest::Approx(1));
+	CHECK(ior.file_index().size() == 2);
+}
+
+#ifdef OPENPMDRAYTRACE_ARROW
+TEST_CASE("[arrow] Record batches") {
+	{
+		raytracing::openPMD_io iow("test_arrow.json");
+		iow.init_write("2112", 5);
+		raytracing::Ray myray;
+		for (size_t i = 0; i < 5; ++i) {
+			myray.set_position(i, 0, 0);
+			myray.set_id(i);
+			iow.trace_write(myray);
+		}
+	}
+
+	raytracing::openPMD_io ior("test_arrow.json");
+	ior.set_chunk_size(5);
+	ior.init_read("2112", 1);
+	const auto& chunk = ior.read_chunk();
+	auto batch        = raytracing::to_record_batch(chunk);
+	CHECK(batch->num_rows() == 5);
+	CHECK(batch->num_columns() == raytracing::kNFields);
+	auto x = std::static_pointer_cast<arrow::FloatArray>(batch->GetColumnByName("x"));
+	CHECK(x->raw_values() == chunk._x.data()); // not copied
+	CHECK(x->Value(3) == doctest::Approx(3));
+
+	// only some of the fields, the others have the default values
+	auto schema = arrow::schema({arrow::field("x", arrow::float32(), false),
+	                             arrow::field("id", arrow::uint64(), false)});
+	auto partial =
+	        arrow::RecordBatch::Make(schema, 5, {batch->GetColumnByName("x"),
+	                                             batch->GetColumnByName("id")});
+	{
+		raytracing::openPMD_io iow("test_arrow_write.json");
+		iow.init_write("2112", 5);
+		raytracing::write_record_batch(iow, *partial);
+	}
+	raytracing::openPMD_io ior2("test_arrow_write.json");
+	CHECK(ior2.init_read("2112", 1) == 5);
+	ior2.trace_read();
+	auto ray = ior2.trace_read();
+	CHECK(ray.x() == doctest::Approx(1));
+	CHECK(ray.get_id() == 1);
+	CHECK(ray.get_weight() == doctest::Approx(1));
+
+	auto wrong = arrow::RecordBatch::Make(
+	        arrow::schema({arrow::field("x", arrow::uint64(), false)}), 5,
+	        {batch->GetColumnByName("id")});
+	raytracing::openPMD_io::Rays rays;
+	CHECK_THROWS(raytracing::from_record_batch(*wrong, rays));
+
+	// round trip through an Arrow IPC file
+	raytracing::openPMD_to_arrow("test_arrow.json", "2112", 1, "test_arrow.arrow", 2);
+	raytracing::arrow_to_openPMD("test_arrow.arrow", "test_arrow_ipc.json", "2112");
+	raytracing::openPMD_io ior3("test_arrow_ipc.json");
+	CHECK(ior3.init_read("2112", 1) == 5);
+	for (size_t i = 0; i < 5; ++i)
+		CHECK(ior3.trace_read().get_id() == i);
+}
+#endif
+
+TEST_CASE("[buffer_pool] Reuse") {
+	auto& pool = buffer_pool::instance();
+	{
+		openPMD_io::Rays chunk;
+		chunk.reserve(1 << 16);
+		CHECK(chunk._x.vals().capacity() >= (1 << 16));
+	}
+	CHECK(pool.cached_bytes() >= 22 * (1 << 16) * sizeof(float));
+
+	// the buffers of the first chunk are reused by the second one
+	auto n_mapped = pool.n_mapped();
+	auto n_reused = pool.n_reused();
+	{
+		openPMD_io::Rays chunk;
+		chunk.reserve(1 << 16);
+	}
+	CHECK(pool.n_mapped() == n_mapped);
+	CHECK(pool.n_reused() == n_reused + kNFields);
+
+	// the buffers beyond the cap are returned to the system
+	auto defaults      = pool.options();
+	auto options       = defaults;
+	options.max_cached = 1 << 16;
+	pool.set_options(options);
+	{
+		openPMD_io::Rays chunk;
+		chunk.reserve(1 << 16);
+	}
+	CHECK(pool.cached_bytes() <= options.max_cached);
+	pool.set_options(defaults);
+}
+
+TEST_CASE("[C interface] Batched neutrons") {
+	const size_t n = 3;
+	double x[n] = {0.01, 0.02, 0.03}, y[n] = {0, 0, 0}, z[n] = {1, 2, 3};
+	double vx[n] = {0, 0, 0}, vy[n] = {0, 0, 0}, vz[n] = {2200, 1000, 500};
+	double t[n] = {1e-3, 2e-3, 3e-3}, p[n] = {1, 2, 3};
+	{
+		auto h = openpmd_rays_open_write("test_c.json", "test code", "2112", n, 1);
+		REQUIRE(h != nullptr);
+		CHECK(openpmd_rays_set_units(h, 100., 1000.) == 0); // m and s
+		CHECK(openpmd_rays_write_neutrons(h, n, x, y, z, vx, vy, vz, t, p, nullptr, nullptr,
+		                                  nullptr) == 0);
+		CHECK(openpmd_rays_close(h) == 0);
+	}
+
+	unsigned long long n_available = 0;
+	auto h = openpmd_rays_open_read("test_c.json", "2112", 1, 0, &n_available);
+	REQUIRE(h != nullptr);
+	CHECK(n_available == n);
+	double cm[n], v[n], w[n];
+	CHECK(openpmd_rays_read(h, n, nullptr, nullptr, cm, nullptr, nullptr, nullptr, nullptr,
+	                        nullptr, nullptr, nullptr) == n);
+	CHECK(cm[1] == doctest::Approx(200)); // stored in cm
+	openpmd_rays_close(h);
+
+	h = openpmd_rays_open_read("test_c.json", "2112", 1, 0, nullptr);
+	openpmd_rays_set_units(h, 100., 1000.);
+	CHECK(openpmd_rays_read_neutrons(h, n, nullptr, nullptr, nullptr, nullptr, nullptr, v,
+	                                 nullptr, w, nullptr, nullptr, nullptr) == n);
+	CHECK(v[2] == doctest::Approx(500));
+	CHECK(w[2] == doctest::Approx(3));
+	openpmd_rays_close(h);
+
+	CHECK(openpmd_rays_open_read("missing.json", "2112", 1, 0, nullptr) == nullptr);
+	CHECK(std::string(openpmd_rays_error()) != "");
+}
+
+TEST_CASE("[C interface] Wavelength in angstrom") {
+	const size_t n = 2;
+	double pos[n] = {0, 0}, dir[n] = {0, 0}, dz[n] = {1, 1};
+	double wavelength[n] = {1.8, 4}, t[n] = {0, 0}, p[n] = {1, 1};
+	auto h = openpmd_rays_open_write("test_c_wavelength.json", "test code", "2112", n, 1);
+	REQUIRE(h != nullptr);
+	// the rays are buffered until the close
+	for (size_t i = 0; i < n; ++i)
+		CHECK(openpmd_rays_write(h, 1, pos + i, pos + i, pos + i, dir + i, dir + i, dz + i,
+		                         wavelength + i, t + i, p + i, nullptr) == 0);
+	CHECK(openpmd_rays_write(h, n, pos, pos, pos, dir, dir, dz, nullptr, t, p, nullptr) == -1);
+	CHECK(std::string(openpmd_rays_error()) != "");
+	CHECK(openpmd_rays_close(h) == 0);
+
+	raytracing::openPMD_io ior("test_c_wavelength.json");
+	CHECK(ior.init_read("2112", 1) == n);
+	CHECK(ior.trace_read().get_wavelength() * 1e10 == doctest::Approx(1.8)); // stored in m
+
+	h = openpmd_rays_open_read("test_c_wavelength.json", "2112", 1, 0, nullptr);
+	double w[n];
+	CHECK(openpmd_rays_read(h, n, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, w,
+	                        nullptr, nullptr, nullptr) == n);
+	CHECK(w[1] == doctest::Approx(4));
+	CHECK(openpmd_rays_close(h) == 0);
+}
@@ -0,0 +1,360 @@
+/** \file
+ * \brief memory and scaling regression harness
+ *
+ * Synthetic neutron and photon rays are written and read back through openPMD_io with each
+ * available backend, for increasing numbers of rays. For each case the wall time, the file
+ * size per ray, the peak resident memory and the number of heap allocations are reported.
+ *
+ * The resident memory is sampled after each chunk, so the peak is the one of the case and
+ * not of the whole process. The program fails if the peak grows by more than the tolerance
+ * from the smallest to the largest case: the memory should depend on the chunk size, not on
+ * the total number of rays.
+ */
+#include "openPMD_io.hh"
+#include <openPMD/openPMD.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using raytracing::openPMD_io;
+
+//------------------------------------------------------------
+// heap allocations made through new, counted for the whole program
+namespace {
+std::atomic<unsigned long long int> n_allocations(0);
+}
+
+void*
+operator new(size_t size) {
+	++n_allocations;
+	if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+	throw std::bad_alloc();
+}
+
+void
+operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept {
+	std::free(p);
+}
+
+namespace {
+//------------------------------------------------------------
+void
+usage(const char* name) {
+	std::cerr << "Usage: " << name << " [options]\n"
+	          << "Writes and reads synthetic rays of increasing size, reporting time, file "
+	             "size and memory\n\n"
+	          << "Options:\n"
+	          << "  -n RAYS,RAYS,...  number of rays per species and iteration\n"
+	          << "                    (default 1000000,10000000)\n"
+	          << "  -c CHUNK          number of rays per chunk (default 100000)\n"
+	          << "  -s SPECIES        number of particle species, neutrons and photons in turn\n"
+	          << "                    (default 2, max 6)\n"
+	          << "  -i ITERATIONS     number of iterations, one file each (default 1)\n"
+	          << "  -b EXT            backend by file extension, can be repeated\n"
+	          << "                    (default: h5 and bp when available)\n"
+	          << "  -t MIB            tolerance on the growth of the peak memory (default 64)\n"
+	          << "  -k                keep the files\n";
+}
+
+/// particle species written: neutrons and photons in turn
+const char* const kSpecies[] = {"2112", "22", "2212", "11", "1000020040", "-11"};
+
+/// current resident memory [bytes]
+size_t
+resident_bytes(void) {
+	std::ifstream statm("/proc/self/statm");
+	size_t pages = 0, resident = 0;
+	statm >> pages >> resident;
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+/// size of a file, or of all the files in a directory (ADIOS2)
+unsigned long long int
+disk_usage(const std::string& path) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) return 0;
+	if (!S_ISDIR(st.st_mode)) return st.st_size;
+	unsigned long long int size = 0;
+	if (DIR* dir = opendir(path.c_str())) {
+		while (dirent* entry = readdir(dir)) {
+			std::string name = entry->d_name;
+			if (name != "." && name != "..") size += disk_usage(path + "/" + name);
+		}
+		closedir(dir);
+	}
+	return size;
+}
+
+/// removes a file, or a directory with its files
+void
+remove_path(const std::string& path) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) return;
+	if (S_ISDIR(st.st_mode)) {
+		if (DIR* dir = opendir(path.c_str())) {
+			while (dirent* entry = readdir(dir)) {
+				std::string name = entry->d_name;
+				if (name != "." && name != "..") remove_path(path + "/" + name);
+			}
+			closedir(dir);
+		}
+		rmdir(path.c_str());
+	} else
+		unlink(path.c_str());
+}
+
+/// synthetic chunk of n neutrons (random velocities) or photons (random polarizations)
+openPMD_io::Rays
+synthetic(size_t n, bool photons, unsigned int seed) {
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> uniform(0.f, 1.f);
+	std::normal_distribution<float> normal(0.f, 1.f);
+	openPMD_io::Rays chunk;
+	raytracing::Ray ray;
+	for (size_t i = 0; i < n; ++i) {
+		ray.set_position(normal(rng), normal(rng), 0);
+		if (photons) {
+			ray.set_direction(normal(rng) * 1e-3, normal(rng) * 1e-3, 1);
+			ray.set_wavelength(1e-10 * (1 + uniform(rng)));
+			ray.set_sPolarization(1, 0, 0, uniform(rng));
+			ray.set_pPolarization(0, 1, 0, uniform(rng));
+		} else
+			ray.set_velocity(normal(rng), normal(rng), 1000 + 1000 * uniform(rng));
+		ray.set_time(uniform(rng));
+		ray.set_weight(uniform(rng));
+		ray.set_id(i);
+		chunk.push(ray);
+	}
+	return chunk;
+}
+
+struct scaling_case {
+	std::string backend;
+	unsigned long long int n_rays = 0; ///< per species and iteration
+	unsigned long long int n_total = 0;
+	double write_time = 0, read_time = 0;
+	unsigned long long int file_size = 0;
+	size_t rss_before = 0, rss_peak = 0;
+	unsigned long long int write_allocations = 0, read_allocations = 0;
+};
+
+double
+seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//------------------------------------------------------------
+scaling_case
+run_case(const std::string& backend, unsigned long long int n_rays, size_t chunk_size,
+         unsigned int n_species, unsigned int n_iterations, bool keep) {
+	scaling_case c;
+	c.backend    = backend;
+	c.n_rays     = n_rays;
+	c.n_total    = n_rays * n_species * n_iterations;
+	c.rss_before = resident_bytes();
+	c.rss_peak   = c.rss_before;
+	auto sample  = [&c]() { c.rss_peak = std::max(c.rss_peak, resident_bytes()); };
+
+	// the same chunks are written over and over, the generation is not timed
+	size_t n_last = n_rays % chunk_size;
+	std::vector<openPMD_io::Rays> chunks, last;
+	for (unsigned int s = 0; s < n_species; ++s) {
+		chunks.push_back(synthetic(std::min<unsigned long long int>(chunk_size, n_rays),
+		                           s % 2 == 1, s));
+		last.push_back(synthetic(n_last, s % 2 == 1, s));
+	}
+	sample();
+
+	std::vector<std::string> filenames;
+	for (unsigned int iter = 1; iter <= n_iterations; ++iter) {
+		std::ostringstream name;
+		name << "scaling_" << n_rays << "_" << iter << "." << backend;
+		filenames.push_back(name.str());
+	}
+
+	auto allocations = n_allocations.load();
+	auto start       = std::chrono::steady_clock::now();
+	for (unsigned int iter = 1; iter <= n_iterations; ++iter) {
+		openPMD_io iow(filenames[iter - 1], "openPMD-raytrace scaling");
+		iow.set_chunk_size(chunk_size);
+		// each species is written in full before the next
+		for (unsigned int s = 0; s < n_species; ++s) {
+			if (s == 0)
+				iow.init_write(kSpecies[s], n_rays, iter);
+			else
+				iow.init_rays(kSpecies[s], n_rays, iter);
+			for (unsigned long long int written = 0; written + chunk_size <= n_rays;
+			     written += chunk_size) {
+				iow.write_chunk(chunks[s]);
+				sample();
+			}
+			if (n_last != 0) iow.write_chunk(last[s]);
+			sample();
+		}
+	}
+	c.write_time        = seconds_since(start);
+	c.write_allocations = n_allocations.load() - allocations;
+
+	for (auto& f : filenames)
+		c.file_size += disk_usage(f);
+
+	allocations = n_allocations.load();
+	start       = std::chrono::steady_clock::now();
+	for (unsigned int iter = 1; iter <= n_iterations; ++iter) {
+		openPMD_io ior(filenames[iter - 1]);
+		ior.set_chunk_size(chunk_size);
+		for (unsigned int s = 0; s < n_species; ++s) {
+			unsigned long long int n_read = 0;
+			ior.init_read(kSpecies[s], iter);
+			for (auto* r = &ior.read_chunk(); r->size() != 0; r = &ior.read_chunk()) {
+				n_read += r->size();
+				sample();
+			}
+			if (n_read != n_rays)
+				throw std::runtime_error("Read " + std::to_string(n_read) + " rays instead of " +
+				                         std::to_string(n_rays) + " in " +
+				                         filenames[iter - 1]);
+		}
+	}
+	c.read_time        = seconds_since(start);
+	c.read_allocations = n_allocations.load() - allocations;
+
+	if (!keep)
+		for (auto& f : filenames)
+			remove_path(f);
+	return c;
+}
+
+void
+report(const scaling_case& c) {
+	const double MiB = 1 << 20;
+	std::cout << std::setw(5) << c.backend << std::setw(12) << c.n_total << std::fixed
+	          << std::setprecision(2) << std::setw(10) << c.write_time << std::setw(10)
+	          << c.n_total / c.write_time / 1e6 << std::setw(10) << c.read_time << std::setw(10)
+	          << c.n_total / c.read_time / 1e6 << std::setw(10)
+	          << static_cast<double>(c.file_size) / c.n_total << std::setw(10)
+	          << c.rss_peak / MiB << std::setw(10) << (c.rss_peak - c.rss_before) / MiB
+	          << std::setw(10) << static_cast<double>(c.write_allocations) / c.n_total
+	          << std::setw(10) << static_cast<double>(c.read_allocations) / c.n_total
+	          << std::endl;
+}
+} // namespace
+
+//------------------------------------------------------------
+int
+main(int argc, char** argv) {
+	std::vector<unsigned long long int> sizes;
+	size_t chunk_size         = 100000;
+	unsigned int n_species    = 2;
+	unsigned int n_iterations = 1;
+	double tolerance          = 64; // MiB
+	bool keep                 = false;
+	std::vector<std::string> backends;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value  = i + 1 < argc;
+		if (arg == "-n" && has_value) {
+			std::istringstream list(argv[++i]);
+			for (std::string n; std::getline(list, n, ',');)
+				sizes.push_back(std::strtoull(n.c_str(), nullptr, 10));
+		} else if (arg == "-c" && has_value)
+			chunk_size = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-s" && has_value)
+			n_species = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-i" && has_value)
+			n_iterations = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-b" && has_value)
+			backends.push_back(argv[++i]);
+		else if (arg == "-t" && has_value)
+			tolerance = std::strtod(argv[++i], nullptr);
+		else if (arg == "-k")
+			keep = true;
+		else if (arg == "-h" || arg == "--help") {
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		} else {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (sizes.empty()) sizes = {1000000, 10000000};
+	std::sort(sizes.begin(), sizes.end());
+	if (sizes.front() == 0 || chunk_size == 0 || n_iterations == 0 || n_species == 0 ||
+	    n_species > sizeof(kSpecies) / sizeof(kSpecies[0])) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	// the JSON backend keeps the whole file in memory: only tested if requested
+	if (backends.empty()) {
+		auto variants = openPMD::getVariants();
+		if (variants["hdf5"]) backends.push_back("h5");
+		if (variants["adios2"]) backends.push_back("bp");
+	}
+	if (backends.empty()) {
+		std::cerr << "[ERROR] No backend available" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	bool failed = false;
+	try {
+		std::cout << "    backend: file extension\n"
+		          << "       rays: total number of rays, all species and iterations\n"
+		          << "  write/read: time [s] and throughput [Mrays/s]\n"
+		          << "   bytes/ray: file size per ray\n"
+		          << "   peak/grow: peak resident memory and its increase during the case [MiB]\n"
+		          << "  alloc/ray: heap allocations per ray when writing and reading\n\n"
+		          << "backend        rays     write  Mrays/s      read  Mrays/s bytes/ray"
+		             "      peak      grow  w-alloc  r-alloc"
+		          << std::endl;
+		for (auto& backend : backends) {
+			std::vector<scaling_case> cases;
+			for (auto n : sizes) {
+				cases.push_back(
+				        run_case(backend, n, chunk_size, n_species, n_iterations, keep));
+				report(cases.back());
+			}
+			if (cases.size() < 2) continue;
+
+			const double MiB = 1 << 20;
+			double growth =
+			        (static_cast<double>(cases.back().rss_peak) - cases.front().rss_peak) / MiB;
+			// the data itself, if it were kept in memory
+			size_t ray_bytes = 0;
+			for (unsigned int f = 0; f < raytracing::kNFields; ++f)
+				ray_bytes += raytracing::get_field_info(raytracing::field_t(f)).size;
+			double data = (cases.back().n_total - cases.front().n_total) * ray_bytes / MiB;
+			if (data < 4 * tolerance)
+				std::cout << "[WARNING] " << backend
+				          << ": the sizes are too close to detect a memory growth" << std::endl;
+			if (growth > tolerance) {
+				std::cerr << "[ERROR] " << backend << ": the peak memory grows by " << growth
+				          << " MiB from " << cases.front().n_total << " to "
+				          << cases.back().n_total << " rays (tolerance " << tolerance
+				          << " MiB)" << std::endl;
+				failed = true;
+			}
+		}
+	} catch (std::exception& e) {
+		std::cerr << "[ERROR] " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
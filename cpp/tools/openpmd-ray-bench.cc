@@ -0,0 +1,133 @@
+#include "openPMD_io.hh"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+///\file
+
+using raytracing::openPMD_io;
+
+namespace {
+void
+usage(const char* name) {
+	std::cerr << "Usage: " << name << " [options] FILE\n"
+	          << "Writes random rays to FILE and reads them back, printing the throughput\n\n"
+	          << "Options:\n"
+	          << "  -n RAYS             number of rays (default 10000000)\n"
+	          << "  -c CHUNK            number of rays per chunk (default 1048576)\n"
+	          << "  --hdf5-chunk RAYS   number of rays per HDF5 chunk\n"
+	          << "  --engine TYPE       ADIOS2 engine type\n"
+	          << "  --aggregators N     ADIOS2 number of aggregators\n"
+	          << "  --buffer SIZE       ADIOS2 initial buffer size (e.g. 1Gb)\n"
+	          << "  --series-json JSON  JSON options of the openPMD Series\n"
+	          << "  --dataset-json JSON JSON options of the datasets\n";
+}
+
+double
+seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void
+report(const char* what, unsigned long long int n_rays, double seconds) {
+	// all the records: 19 floats, one unsigned long long, one int
+	double bytes = n_rays * (19 * sizeof(float) + sizeof(unsigned long long int) + sizeof(int));
+	std::cout << what << ": " << seconds << " s, " << n_rays / seconds / 1e6 << " Mrays/s, "
+	          << bytes / seconds / (1 << 20) << " MiB/s" << std::endl;
+}
+} // namespace
+
+int
+main(int argc, char** argv) {
+	unsigned long long int n_rays = 10000000;
+	size_t chunk_size             = 1 << 20;
+	raytracing::backend_config config;
+	std::vector<std::string> files;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value  = i + 1 < argc;
+		if (arg == "-n" && has_value)
+			n_rays = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-c" && has_value)
+			chunk_size = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--hdf5-chunk" && has_value)
+			config.hdf5_chunk = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--engine" && has_value)
+			config.adios2_engine = argv[++i];
+		else if (arg == "--aggregators" && has_value)
+			config.adios2_aggregators = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--buffer" && has_value)
+			config.adios2_buffer_size = argv[++i];
+		else if (arg == "--series-json" && has_value)
+			config.series_json = argv[++i];
+		else if (arg == "--dataset-json" && has_value)
+			config.dataset_json = argv[++i];
+		else if (arg == "-h" || arg == "--help") {
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		} else if (!arg.empty() && arg[0] == '-') {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		} else
+			files.push_back(arg);
+	}
+	if (files.size() != 1 || n_rays == 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	try {
+		// the same chunk is written over and over, the generation is not timed
+		std::mt19937 rng(0);
+		std::uniform_real_distribution<float> uniform(0.f, 1.f);
+		openPMD_io::Rays chunk;
+		raytracing::Ray ray;
+		for (size_t i = 0; i < std::min<unsigned long long int>(chunk_size, n_rays); ++i) {
+			ray.set_position(uniform(rng), uniform(rng), uniform(rng));
+			ray.set_velocity(uniform(rng), uniform(rng), 1);
+			ray.set_wavelength(uniform(rng) * 1e-9);
+			ray.set_time(uniform(rng));
+			ray.set_weight(uniform(rng));
+			ray.set_id(i);
+			chunk.push(ray);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		{
+			openPMD_io iow(files[0], "openpmd-ray-bench");
+			iow.set_backend_config(config);
+			iow.set_chunk_size(chunk_size);
+			iow.init_write("2112", n_rays);
+			for (unsigned long long int written = 0; written < n_rays;) {
+				if (n_rays - written < chunk.size()) {
+					openPMD_io::Rays last;
+					for (size_t i = 0; written + i < n_rays; ++i)
+						last.push(chunk.pop());
+					iow.write_chunk(last);
+					break;
+				}
+				iow.write_chunk(chunk);
+				written += chunk.size();
+			}
+		}
+		report("write", n_rays, seconds_since(start));
+
+		start = std::chrono::steady_clock::now();
+		unsigned long long int n_read = 0;
+		{
+			openPMD_io ior(files[0]);
+			ior.set_backend_config(config);
+			ior.set_chunk_size(chunk_size);
+			ior.init_read("2112");
+			for (auto* c = &ior.read_chunk(); c->size() != 0; c = &ior.read_chunk())
+				n_read += c->size();
+		}
+		report("read ", n_read, seconds_since(start));
+	} catch (std::exception& e) {
+		std::cerr << "[ERROR] " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,66 @@
+#include "ray_merge.hh"
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+///\file
+
+namespace {
+void
+usage(const char* name) {
+	std::cerr << "Usage: " << name << " [options] OUTPUT INPUT [INPUT ...]\n"
+	          << "Concatenates the rays of the INPUT files into OUTPUT\n\n"
+	          << "Options:\n"
+	          << "  -s PDGID      particle species (default 2112)\n"
+	          << "  -i ITER       openPMD iteration (default 1)\n"
+	          << "  -j THREADS    number of files read in parallel, ADIOS2 and JSON files only\n"
+	          << "                (default 1)\n"
+	          << "  -c CHUNK      number of rays copied at once (default 1048576)\n"
+	          << "  --renumber-id replace the ray ids by their index in OUTPUT\n";
+}
+} // namespace
+
+int
+main(int argc, char** argv) {
+	std::string particle_species = "2112";
+	unsigned int iter            = 1;
+	raytracing::merge_options options;
+	std::vector<std::string> files;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value  = i + 1 < argc;
+		if (arg == "-s" && has_value)
+			particle_species = argv[++i];
+		else if (arg == "-i" && has_value)
+			iter = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-j" && has_value)
+			options.n_threads = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-c" && has_value)
+			options.chunk_size = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--renumber-id")
+			options.renumber_id = true;
+		else if (arg == "-h" || arg == "--help") {
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		} else if (!arg.empty() && arg[0] == '-') {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		} else
+			files.push_back(arg);
+	}
+	if (files.size() < 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::string output = files.front();
+	files.erase(files.begin());
+	try {
+		auto n_rays = raytracing::merge_files(files, output, particle_species, iter, options);
+		std::cout << n_rays << " rays written to " << output << std::endl;
+	} catch (std::exception& e) {
+		std::cerr << "[ERROR] " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,69 @@
+#include "ray_shard.hh"
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+///\file
+
+namespace {
+void
+usage(const char* name) {
+	std::cerr << "Usage: " << name << " [options] INPUT OUTPUT N_SHARDS\n"
+	          << "Splits the rays of INPUT in N_SHARDS files named after OUTPUT\n"
+	          << "(e.g. shard.h5 gives shard_0.h5, shard_1.h5, ...)\n\n"
+	          << "Options:\n"
+	          << "  -s PDGID      particle species (default 2112)\n"
+	          << "  -i ITER       openPMD iteration (default 1)\n"
+	          << "  -j THREADS    number of shards written in parallel, ADIOS2 and JSON files only\n"
+	          << "                (default 1)\n"
+	          << "  -c CHUNK      number of rays copied at once (default 1048576)\n"
+	          << "  --weight      balance the total weight instead of the number of rays\n";
+}
+} // namespace
+
+int
+main(int argc, char** argv) {
+	std::string particle_species = "2112";
+	unsigned int iter            = 1;
+	raytracing::shard_options options;
+	std::vector<std::string> args;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value  = i + 1 < argc;
+		if (arg == "-s" && has_value)
+			particle_species = argv[++i];
+		else if (arg == "-i" && has_value)
+			iter = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-j" && has_value)
+			options.n_threads = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-c" && has_value)
+			options.chunk_size = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--weight")
+			options.balance = raytracing::kBalanceWeight;
+		else if (arg == "-h" || arg == "--help") {
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		} else if (!arg.empty() && arg[0] == '-') {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		} else
+			args.push_back(arg);
+	}
+	if (args.size() != 3) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	try {
+		auto n_shards = std::strtoul(args[2].c_str(), nullptr, 10);
+		auto shards =
+		        raytracing::split_file(args[0], args[1], particle_species, n_shards, iter, options);
+		for (const auto& shard : shards)
+			std::cout << shard.filename << ": rays [" << shard.first << ", " << shard.last
+			          << "), weight " << shard.weight << std::endl;
+	} catch (std::exception& e) {
+		std::cerr << "[ERROR] " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,90 @@
+#include "ray_stats.hh"
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+///\file
+
+using raytracing::beam_stats;
+
+namespace {
+void
+usage(const char* name) {
+	std::cerr << "Usage: " << name << " [options] FILE\n"
+	          << "Prints the weighted moments of the rays of FILE\n\n"
+	          << "Options:\n"
+	          << "  -s PDGID      particle species (default 2112)\n"
+	          << "  -i ITER       openPMD iteration (default 1)\n"
+	          << "  -j THREADS    number of ranges of rays reduced in parallel, ADIOS2 and JSON\n"
+	          << "                files only (default 1)\n"
+	          << "  -c CHUNK      number of rays read at once (default 1048576)\n"
+	          << "  --cov         print the covariance matrix\n";
+}
+} // namespace
+
+int
+main(int argc, char** argv) {
+	std::string particle_species = "2112";
+	unsigned int iter            = 1;
+	bool print_covariance        = false;
+	raytracing::stats_options options;
+	std::vector<std::string> files;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value  = i + 1 < argc;
+		if (arg == "-s" && has_value)
+			particle_species = argv[++i];
+		else if (arg == "-i" && has_value)
+			iter = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-j" && has_value)
+			options.n_threads = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "-c" && has_value)
+			options.chunk_size = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--cov")
+			print_covariance = true;
+		else if (arg == "-h" || arg == "--help") {
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		} else if (!arg.empty() && arg[0] == '-') {
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		} else
+			files.push_back(arg);
+	}
+	if (files.size() != 1) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	try {
+		auto stats = raytracing::compute_stats(files[0], particle_species, iter, options);
+		std::cout << "rays       " << stats.n_rays() << "\n"
+		          << "intensity  " << stats.intensity() << "\n\n"
+		          << std::setw(11) << "" << std::setw(14) << "mean" << std::setw(14) << "rms"
+		          << "\n";
+		for (unsigned int i = 0; i < beam_stats::kNStatFields; ++i) {
+			auto f = beam_stats::stat_field(i);
+			std::cout << std::left << std::setw(11) << raytracing::get_field_info(f).name
+			          << std::right << std::setw(14) << stats.mean(f) << std::setw(14)
+			          << stats.rms(f) << "\n";
+		}
+		std::cout << "\nemittance  x " << stats.emittance(raytracing::kX) << "  y "
+		          << stats.emittance(raytracing::kY) << std::endl;
+
+		if (print_covariance) {
+			std::cout << "\ncovariance\n";
+			for (unsigned int i = 0; i < beam_stats::kNStatFields; ++i) {
+				for (unsigned int j = 0; j < beam_stats::kNStatFields; ++j)
+					std::cout << std::setw(14)
+					          << stats.covariance(beam_stats::stat_field(i),
+					                              beam_stats::stat_field(j));
+				std::cout << "\n";
+			}
+		}
+	} catch (std::exception& e) {
+		std::cerr << "[ERROR] " << e.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -5,18 +5,52 @@ namespace py = pybind11;
 #include "config.h"
 #include <openPMD_io.hh>
 #include <ray.hh>
+#include <ray_stats.hh>
 using namespace raytracing;
 
 PYBIND11_MODULE(MODULE_NAME, m) {
 
 	m.doc() = "pybind11 example plugin"; // optional module docstring
-m.
+
+	// weighted moments, returned as a dict with the same names as the Ray getters
+	m.def(
+	        "compute_stats",
+	        [](const std::string& filename, const std::string& particle_species,
+	           unsigned int iter, unsigned int n_threads) {
+		        stats_options options;
+		        options.n_threads = n_threads;
+		        auto stats = compute_stats(filename, particle_species, iter, options);
+		        py::dict result, mean, rms, covariance;
+		        for (unsigned int i = 0; i < beam_stats::kNStatFields; ++i) {
+			        auto f         = beam_stats::stat_field(i);
+			        auto name      = get_field_info(f).name;
+			        mean[name]     = stats.mean(f);
+			        rms[name]      = stats.rms(f);
+			        py::list row;
+			        for (unsigned int j = 0; j < beam_stats::kNStatFields; ++j)
+				        row.append(stats.covariance(f, beam_stats::stat_field(j)));
+			        covariance[name] = row;
+		        }
+		        result["n_rays"]     = stats.n_rays();
+		        result["intensity"]  = stats.intensity();
+		        result["mean"]       = mean;
+		        result["rms"]        = rms;
+		        result["covariance"] = covariance;
+		        result["emittance_x"] = stats.emittance(kX);
+		        result["emittance_y"] = stats.emittance(kY);
+		        return result;
+	        },
+	        py::arg("filename"), py::arg("particle_species") = "2112", py::arg("iter") = 1,
+	        py::arg("n_threads") = 1);
+
 	py::class_<openPMD_io>(m, "openPMD_io")
 	        .def(py::init<const std::string&, const std::string, const std::string,
 	                      const std::string, const std::string>())
 	        .def("init_write", &openPMD_io::init_write)
 	        .def("init_rays", &openPMD_io::init_rays)
-	        .def("trace_write", &openPMD_io::trace_write)
+	        .def("trace_write", py::overload_cast<Ray>(&openPMD_io::trace_write))
+	        .def("trace_write",
+	             py::overload_cast<const std::string&, Ray>(&openPMD_io::trace_write))
 	        .def("save_write", &openPMD_io::save_write)
 	        .def("init_read", &openPMD_io::init_read)
 	        .def("trace_read", &openPMD_io::trace_read) //